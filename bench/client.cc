@@ -0,0 +1,73 @@
+#include "lib/bench.h"
+
+using namespace bench;
+
+static void respond_hello (const ServerRequestSP& req) {
+    req->respond(new ServerResponse(200, Headers(), Body("hello world")));
+}
+
+// keeps `inflight` requests running through the pool, spreading them over servers round-robin
+static Result run_pool (const Options& opts, size_t nservers, size_t inflight, Pool::Config cfg) {
+    LoopSP loop = new Loop();
+    std::vector<ServerSP> servers;
+    std::vector<string>   uris;
+    for (size_t i = 0; i < nservers; ++i) {
+        servers.push_back(make_server(loop, respond_hello));
+        auto sa = servers.back()->sockaddr().value();
+        string uri("http://");
+        uri += sa.ip();
+        uri += ":";
+        uri += to_string(sa.port());
+        uri += "/";
+        uris.push_back(uri);
+    }
+
+    PoolSP pool = new Pool(cfg, loop);
+    Result ret;
+    ret.params["hosts"]    = nservers;
+    ret.params["inflight"] = inflight;
+
+    size_t total = std::max<size_t>(inflight, 100000 * opts.scale);
+    size_t sent = 0, done = 0;
+    std::function<void()> send;
+    send = [&] {
+        auto start = Clock::now();
+        auto req = Request::Builder().method(Request::Method::Get).uri(uris[sent++ % uris.size()]).build();
+        req->response_event.add([&, start](auto&, auto&, auto& err) {
+            if (err) throw std::runtime_error(std::string("request failed: ") + err.what().c_str());
+            ret.latency.add(Clock::now() - start);
+            if (++done == total) return loop->stop();
+            if (sent < total) send();
+        });
+        pool->request(req);
+    };
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < inflight; ++i) send();
+    loop->run();
+    ret.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    ret.ops     = done;
+
+    for (auto& s : servers) s->stop();
+    return ret;
+}
+
+BENCH("pool-fanout") {
+    Pool::Config cfg;
+    cfg.max_connections = 4;
+    return run_pool(opts, 16, 64, cfg);
+}
+
+// request/putback cost with 1k connections to one host
+BENCH("pool-1k-connections") {
+    Pool::Config cfg;
+    cfg.max_connections = 1000;
+    return run_pool(opts, 1, 1000, cfg);
+}
+
+BENCH("pool-pipelined") {
+    Pool::Config cfg;
+    cfg.max_connections = 4;
+    cfg.pipeline_depth  = 16;
+    return run_pool(opts, 1, 64, cfg);
+}
@@ -0,0 +1,160 @@
+#include "bench.h"
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <openssl/ssl.h>
+
+namespace bench {
+
+using Registry = std::vector<std::pair<string, Function>>;
+
+static Registry& registry () {
+    static Registry r;
+    return r;
+}
+
+bool register_bench (const string& name, const Function& fn) {
+    registry().emplace_back(name, fn);
+    return true;
+}
+
+int run (const Options& opts) {
+    int n = 0;
+    for (auto& row : registry()) {
+        if (opts.filter && row.first.find(opts.filter) == string::npos) continue;
+        ++n;
+        if (opts.list) {
+            std::cout << row.first << std::endl;
+            continue;
+        }
+        auto result = row.second(opts);
+        result.name = row.first;
+        report(result);
+    }
+    if (!n) std::cerr << "no benchmarks match '" << opts.filter << "'" << std::endl;
+    return n ? 0 : 1;
+}
+
+uint64_t Histogram::percentile (double p) {
+    if (_samples.empty()) return 0;
+    if (!_sorted) {
+        std::sort(_samples.begin(), _samples.end());
+        _sorted = true;
+    }
+    auto idx = std::min(_samples.size() - 1, size_t(_samples.size() * p / 100));
+    return _samples[idx];
+}
+
+uint64_t Histogram::max () { return percentile(100); }
+
+void report (Result& r) {
+    char buf[128];
+    std::cout << "{\"bench\":\"" << r.name << "\",\"ops\":" << r.ops;
+    snprintf(buf, sizeof(buf), ",\"seconds\":%.6f,\"rate\":%.1f", r.seconds, r.rate());
+    std::cout << buf;
+    for (auto& p : r.params) std::cout << ",\"" << p.first << "\":" << p.second;
+    if (r.latency.count()) {
+        std::cout << ",\"latency_us\":{\"p50\":" << r.latency.percentile(50) << ",\"p90\":" << r.latency.percentile(90)
+                  << ",\"p99\":" << r.latency.percentile(99) << ",\"p999\":" << r.latency.percentile(99.9)
+                  << ",\"max\":" << r.latency.max() << "}";
+    }
+    std::cout << "}" << std::endl;
+
+    snprintf(buf, sizeof(buf), "%-24s %12.0f ops/s", r.name.c_str(), r.rate());
+    std::cerr << buf;
+    if (r.latency.count()) {
+        snprintf(buf, sizeof(buf), "   p50 %6llu us   p99 %6llu us   max %6llu us", (unsigned long long)r.latency.percentile(50),
+                 (unsigned long long)r.latency.percentile(99), (unsigned long long)r.latency.max());
+        std::cerr << buf;
+    }
+    std::cerr << std::endl;
+}
+
+ServerSP make_server (const LoopSP& loop, const std::function<void(const ServerRequestSP&)>& handler, bool tls, const string& path) {
+    Server::Location loc;
+    if (path) loc.path = path;
+    else      loc.host = "127.0.0.1";
+    if (tls) loc.ssl_ctx = server_ssl_context();
+
+    Server::Config cfg;
+    cfg.locations.push_back(loc);
+    cfg.tcp_nodelay = true;
+
+    ServerSP server = new Server(cfg, loop);
+    server->request_event.add(handler);
+    server->run();
+    return server;
+}
+
+// the same certificate as tests use, run from the repository root
+SslContext server_ssl_context () {
+    auto ret = SslContext::attach(SSL_CTX_new(TLS_server_method()));
+    SSL_CTX* ctx = ret;
+    if (!SSL_CTX_use_certificate_file(ctx, "tests/cert/ca.pem", SSL_FILETYPE_PEM) ||
+        !SSL_CTX_use_PrivateKey_file(ctx, "tests/cert/ca.key", SSL_FILETYPE_PEM))
+    {
+        throw std::runtime_error("can not load tests/cert/ca.pem, benchmarks must be run from the repository root");
+    }
+    return ret;
+}
+
+SslContext client_ssl_context () {
+    return SslContext::attach(SSL_CTX_new(TLS_client_method()));
+}
+
+Result Load::run (const LoopSP& loop, const Connect& connect) {
+    Result ret;
+    ret.params["connections"] = connections;
+    ret.params["depth"]       = depth;
+    _loop    = loop;
+    _result  = &ret;
+    _sent    = _done = 0;
+    _context = new protocol::http::Request();
+    _conns.clear();
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < connections; ++i) {
+        _conns.emplace_back(new Conn());
+        auto& c = *_conns.back();
+        c.stream = connect(loop);
+        c.stream->read_event.add([this, &c](auto, auto& buf, auto& err) { on_read(c, buf, err); });
+        c.stream->eof_event.add([](auto) { throw std::runtime_error("server closed connection"); });
+        for (size_t j = 0; j < depth && _sent < requests; ++j) send(c);
+    }
+    loop->run();
+    ret.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    ret.ops     = _done;
+
+    for (auto& c : _conns) {
+        c->stream->read_event.remove_all();
+        c->stream->eof_event.remove_all();
+        c->stream->reset();
+    }
+    _conns.clear();
+    _result = nullptr;
+    return ret;
+}
+
+void Load::send (Conn& c) {
+    c.inflight.push_back(Clock::now());
+    c.stream->write(request);
+    ++_sent;
+}
+
+void Load::on_read (Conn& c, string& buf, const ErrorCode& err) {
+    if (err) throw std::runtime_error(std::string("read error: ") + err.what().c_str());
+    while (buf) {
+        if (!c.parser.context_request()) c.parser.set_context_request(_context);
+        auto result = c.parser.parse_shift(buf);
+        if (result.error) throw std::runtime_error(std::string("bad response: ") + result.error.what().c_str());
+        if (result.state != protocol::http::State::done) return;
+
+        _result->latency.add(Clock::now() - c.inflight.front());
+        c.inflight.pop_front();
+        if (++_done == requests) return _loop->stop();
+        if (_sent < requests) send(c);
+    }
+}
+
+}
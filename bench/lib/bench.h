@@ -0,0 +1,111 @@
+#pragma once
+#include <panda/unievent/http.h>
+#include <panda/unievent/http/Server.h>
+#include <panda/unievent/Pipe.h>
+#include <panda/protocol/http/ResponseParser.h>
+#include <map>
+#include <deque>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+using namespace panda;
+using panda::unievent::Tcp;
+using panda::unievent::TcpSP;
+using panda::unievent::Pipe;
+using panda::unievent::PipeSP;
+using panda::unievent::Stream;
+using panda::unievent::StreamSP;
+using panda::unievent::Loop;
+using panda::unievent::LoopSP;
+using panda::unievent::Timer;
+using panda::unievent::TimerSP;
+using panda::unievent::SslContext;
+using namespace panda::unievent::http;
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    string filter;        // run only benchmarks whose name contains it
+    double scale = 1;     // multiplier of the number of requests/operations
+    bool   list  = false;
+};
+
+// latencies in microseconds, percentiles are exact
+struct Histogram {
+    void     add        (Clock::duration d) { _samples.push_back(std::chrono::duration_cast<std::chrono::microseconds>(d).count()); }
+    size_t   count      () const { return _samples.size(); }
+    uint64_t percentile (double p);
+    uint64_t max        ();
+
+private:
+    std::vector<uint64_t> _samples;
+    bool                  _sorted = false;
+};
+
+struct Result {
+    string    name;
+    uint64_t  ops     = 0;  // requests or operations done
+    double    seconds = 0;
+    Histogram latency;      // empty for micro benchmarks
+    std::map<string, uint64_t> params; // what the numbers depend on: connections, depth, ...
+
+    double rate () const { return seconds > 0 ? ops / seconds : 0; }
+};
+
+using Function = std::function<Result(const Options&)>;
+
+bool register_bench (const string& name, const Function&);
+int  run            (const Options&);
+
+// JSON object per line to stdout (for tooling), summary to stderr
+void report (Result&);
+
+#define BENCH_CAT2(a, b) a##b
+#define BENCH_CAT(a, b) BENCH_CAT2(a, b)
+#define BENCH(name) \
+    static Result BENCH_CAT(bench_fn_, __LINE__) (const Options&); \
+    static bool BENCH_CAT(bench_reg_, __LINE__) = register_bench(name, BENCH_CAT(bench_fn_, __LINE__)); \
+    static Result BENCH_CAT(bench_fn_, __LINE__) (const Options& opts)
+
+// server listening on loopback (or unix socket if path is given), responding with handler
+ServerSP make_server (const LoopSP&, const std::function<void(const ServerRequestSP&)>& handler, bool tls = false, const string& path = {});
+
+SslContext server_ssl_context ();
+SslContext client_ssl_context ();
+
+// Drives a server with raw connections: every connection keeps `depth` requests in flight (pipelined if > 1) until `requests` are answered
+struct Load {
+    using Connect = std::function<StreamSP(const LoopSP&)>; // creates connecting stream
+
+    size_t connections = 16;
+    size_t depth       = 1;
+    size_t requests    = 100000;
+    string request     = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+    Result run (const LoopSP&, const Connect&);
+
+private:
+    struct Conn {
+        StreamSP                       stream;
+        protocol::http::ResponseParser parser;
+        std::deque<Clock::time_point>  inflight; // send times of requests waiting for response
+    };
+    using Conns = std::vector<std::unique_ptr<Conn>>;
+
+    LoopSP                    _loop;
+    Conns                     _conns;
+    protocol::http::RequestSP _context;
+    size_t                    _sent   = 0;
+    size_t                    _done   = 0;
+    Result*                   _result = nullptr;
+
+    void send    (Conn&);
+    void on_read (Conn&, string&, const ErrorCode&);
+};
+
+}
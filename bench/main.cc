@@ -0,0 +1,25 @@
+#include "lib/bench.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+static void usage () {
+    std::cerr << "usage: unievent-http-bench [--list] [--filter <substring>] [--scale <x>]\n"
+                 "  prints one JSON object per benchmark to stdout and a summary to stderr\n"
+                 "  must be run from the repository root (TLS benchmarks use tests/cert)\n";
+}
+
+int main (int argc, char** argv) {
+    bench::Options opts;
+    for (int i = 1; i < argc; ++i) {
+        auto arg = argv[i];
+        if (!strcmp(arg, "--list")) opts.list = true;
+        else if (!strcmp(arg, "--filter") && i + 1 < argc) opts.filter = argv[++i];
+        else if (!strcmp(arg, "--scale") && i + 1 < argc) opts.scale = atof(argv[++i]);
+        else {
+            usage();
+            return 2;
+        }
+    }
+    return bench::run(opts);
+}
@@ -0,0 +1,83 @@
+#include "lib/bench.h"
+#include <unistd.h>
+
+using namespace bench;
+
+static size_t scaled (const Options& opts, size_t n) { return std::max<size_t>(1, n * opts.scale); }
+
+static Load::Connect tcp_to (const ServerSP& server, const SslContext& ctx = {}) {
+    auto sa = server->sockaddr().value();
+    return [sa, ctx](const LoopSP& loop) -> StreamSP {
+        TcpSP conn = new Tcp(loop);
+        if (ctx) conn->use_ssl(ctx);
+        conn->connect(sa);
+        return conn;
+    };
+}
+
+static void respond_hello (const ServerRequestSP& req) {
+    req->respond(new ServerResponse(200, Headers(), Body("hello world")));
+}
+
+static Result run_load (const Options& opts, size_t connections, size_t depth, const std::function<void(const ServerRequestSP&)>& handler,
+                        bool tls = false)
+{
+    LoopSP loop = new Loop();
+    auto server = make_server(loop, handler, tls);
+    Load load;
+    load.connections = connections;
+    load.depth       = depth;
+    load.requests    = scaled(opts, tls ? 50000 : 200000);
+    auto ret = load.run(loop, tcp_to(server, tls ? client_ssl_context() : SslContext()));
+    server->stop();
+    return ret;
+}
+
+BENCH("server-keepalive") {
+    return run_load(opts, 16, 1, respond_hello);
+}
+
+BENCH("server-pipelined") {
+    return run_load(opts, 4, 16, respond_hello);
+}
+
+BENCH("server-chunked") {
+    return run_load(opts, 16, 1, [](const ServerRequestSP& req) {
+        ServerResponseSP res = new ServerResponse(200, Headers(), Body(), true);
+        req->respond(res);
+        res->send_chunk("hello ");
+        res->send_chunk("world");
+        res->send_final_chunk();
+    });
+}
+
+BENCH("server-frozen") {
+    ServerResponseSP res = new ServerResponse(200, Headers(), Body("hello world"));
+    res->freeze();
+    return run_load(opts, 16, 1, [res](const ServerRequestSP& req) { req->respond(res); });
+}
+
+BENCH("server-tls") {
+    return run_load(opts, 16, 1, respond_hello, true);
+}
+
+BENCH("server-unix") {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/unievent-http-bench-%d.sock", (int)getpid());
+    unlink(path);
+
+    LoopSP loop = new Loop();
+    auto server = make_server(loop, respond_hello, false, path);
+    Load load;
+    load.connections = 16;
+    load.requests    = scaled(opts, 200000);
+    string spath(path);
+    auto ret = load.run(loop, [spath](const LoopSP& loop) -> StreamSP {
+        PipeSP conn = new Pipe(loop);
+        conn->connect(spath);
+        return conn;
+    });
+    server->stop();
+    unlink(path);
+    return ret;
+}
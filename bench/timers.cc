@@ -0,0 +1,47 @@
+#include "lib/bench.h"
+#include <panda/unievent/http/TimerWheel.h>
+
+using namespace bench;
+
+// Re-arming of keep-alive idle timeouts, as server does on every request: a loop timer per connection vs shared TimerWheel
+
+static const size_t   NTIMEOUTS = 10000;
+static const uint64_t TIMEOUT   = 60000;
+
+struct NoopListener : TimerWheel::IListener {
+    void on_wheel_timeout () override {}
+};
+
+BENCH("timer-rearm-loop-timers") {
+    LoopSP loop = new Loop();
+    std::vector<TimerSP> timers;
+    for (size_t i = 0; i < NTIMEOUTS; ++i) timers.push_back(new Timer(loop));
+
+    Result ret;
+    ret.params["timeouts"] = NTIMEOUTS;
+    ret.ops = std::max<size_t>(NTIMEOUTS, 5000000 * opts.scale);
+    auto start = Clock::now();
+    for (size_t i = 0; i < ret.ops; ++i) timers[i % NTIMEOUTS]->once(TIMEOUT);
+    ret.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for (auto& t : timers) t->stop();
+    return ret;
+}
+
+BENCH("timer-rearm-wheel") {
+    LoopSP loop = new Loop();
+    TimerWheel wheel(loop, TIMEOUT / 16);
+    NoopListener listener;
+    std::vector<TimerWheel::Handle> handles;
+    for (size_t i = 0; i < NTIMEOUTS; ++i) handles.push_back(wheel.add(&listener));
+
+    Result ret;
+    ret.params["timeouts"] = NTIMEOUTS;
+    ret.ops = std::max<size_t>(NTIMEOUTS, 5000000 * opts.scale);
+    auto start = Clock::now();
+    for (size_t i = 0; i < ret.ops; ++i) wheel.arm(handles[i % NTIMEOUTS], TIMEOUT);
+    ret.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for (auto h : handles) wheel.remove(h);
+    return ret;
+}
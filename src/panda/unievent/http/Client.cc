@@ -1,5 +1,6 @@
 #include "Pool.h"
 #include "Client.h"
+#include "SslConfig.h"
 #include "panda/unievent/SslContext.h"
 #include <ostream>
 #include <panda/log.h>
@@ -11,6 +12,7 @@
 namespace panda { namespace unievent { namespace http {
 
 using namespace panda::unievent::socks;
+using Clock = std::chrono::steady_clock;
 
 const string DEFAULT_UA = "Mozilla/5.0 (Windows NT 6.1; WOW64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/47.0.2526.111 Safari/537.36 UniEvent-HTTP/1.0";
 
@@ -30,6 +32,11 @@ static inline bool is_redirect (int code) {
     return false;
 }
 
+static int tls_ex_index () {
+    static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
 Client::Client (const LoopSP& loop) : Tcp(loop), _netloc({"", 0, nullptr, {}}) {
     Tcp::event_listener(this);
 }
@@ -45,65 +52,30 @@ void Client::request (const RequestSP& request) {
     panda_log_info("request:\n" << request->to_string());
 
     request->_client = this;
+    if (request->timings.dequeue(Clock::now())) request->trace_start();
     if (!request->uri->scheme()) request->uri->scheme("http");
 
     auto netloc = request->netloc();
 
-    if (!connected() || _netloc != netloc || !request->keep_alive()) {
-        panda_log_info("connecting to " << netloc);
-        if (connected()) drop_connection();
-        filters().clear();
-
-        if (request->uri->secure()) {
-            SslContext ctx = request->ssl_ctx;
-            if (!ctx) {
-                ctx = get_default_ssl_context(request->ssl_check_cert);
-            }
-            Tcp::use_ssl(ctx);
-            auto ssl = Tcp::get_ssl();
-            SSL_set_tlsext_host_name(ssl, request->uri->host().c_str());
-            if (request->ssl_check_cert) {
-                string host = request->uri->host();
-                auto param = SSL_get0_param(ssl);
-                X509_VERIFY_PARAM_set1_host(param, host.data(), host.size());
-            }
-        }
-
-        if (request->proxy) {
-            auto uri = request->proxy;
-            if (uri->scheme() == "socks5") {
-                SocksSP socks = new Socks(uri->host(), uri->port(), uri->user(), uri->password());
-                socks->socks_resolve = request->proxy_resolve;
-                use_socks(this, socks);
-            }
-            else if (uri->scheme() == "http") {
-                // netloc =  NetLoc { uri->host(), uri->port(), nullptr, nullptr, false };
-                // no-op
-            }
-            else throw HttpError("client supports only socks5 protocol for proxy");
-        }
-
-        if (request->tcp_nodelay) set_nodelay(true);
-        _netloc = std::move(netloc);
-        auto conn_timeout = request->connect_timeout ? request->connect_timeout : request->timeout;
-        connect(_netloc.host, _netloc.port, conn_timeout, request->tcp_hints);
+    // connection might be still being established by Pool::prewarm()
+    if (!(connected() || connecting() || _resolving) || _netloc != netloc || !request->keep_alive()) {
+        establish(request, std::move(netloc));
     }
 
     // this code should be after connect, because in case of connect timeout, timer inside Tcp class must react first to mark multiDNS address as bad
     if (request->timeout) request->ensure_timer_active(loop());
 
     Tcp::weak(false);
-    _request = request;
-
-    using namespace panda::protocol::http;
-    if (request->compression_prefs == static_cast<std::uint8_t>(Compression::IDENTITY) && !request->headers.has("Accept-Encoding")) {
-        request->allow_compression(Compression::GZIP);
-    }
+    _request  = request;
+    _received = false;
 
-    auto data = request->to_vector();
     _parser.set_context_request(request);
+    if (_resolving) return; // sent by on_resolved()
+    send_request(request);
+}
 
-    write(data.begin(), data.end());
+void Client::send_request (const RequestSP& request) {
+    write_request(request);
     if (request->form_streaming()) {
         _form_field = 0;
         send_form();
@@ -113,6 +85,288 @@ void Client::request (const RequestSP& request) {
     }
 }
 
+void Client::establish (const RequestSP& request, NetLoc&& netloc, const net::SockAddr* addr) {
+    panda_log_info("connecting to " << netloc);
+    if (connected() || connecting() || _resolving) drop_connection();
+    filters().clear();
+
+    if (request->uri->secure()) {
+        SslContext ctx = request->ssl_ctx;
+        if (!ctx) {
+            ctx = get_default_ssl_context(request->ssl_check_cert);
+        }
+        Tcp::use_ssl(ctx);
+        auto ssl = Tcp::get_ssl();
+        SSL_set_ex_data(ssl, tls_ex_index(), this);
+        SSL_set_info_callback(ssl, on_tls_info);
+        SSL_set_tlsext_host_name(ssl, request->uri->host().c_str());
+        resume_tls_session(ssl, netloc);
+        // only HTTP/1.1 is spoken, announce it so that servers requiring ALPN accept us and never select h2
+        static const unsigned char alpn[] = "\x08http/1.1";
+        SSL_set_alpn_protos(ssl, alpn, sizeof(alpn) - 1);
+        if (request->ssl_check_cert) {
+            string host = request->uri->host();
+            auto param = SSL_get0_param(ssl);
+            X509_VERIFY_PARAM_set1_host(param, host.data(), host.size());
+        }
+    }
+    else _tls_key.clear();
+
+    if (request->proxy) {
+        auto uri = request->proxy;
+        if (uri->scheme() == "socks5") {
+            SocksSP socks = new Socks(uri->host(), uri->port(), uri->user(), uri->password());
+            socks->socks_resolve = request->proxy_resolve;
+            use_socks(this, socks);
+        }
+        else if (uri->scheme() == "http") {
+            // netloc =  NetLoc { uri->host(), uri->port(), nullptr, nullptr, false };
+            // no-op
+        }
+        else throw HttpError("client supports only socks5 protocol for proxy");
+    }
+
+    if (request->tcp_nodelay) set_nodelay(true);
+    _netloc  = std::move(netloc);
+    _nserved = 0;
+    _connect_start = loop()->now();
+    _addrs.clear();
+    auto conn_timeout = request->connect_timeout ? request->connect_timeout : request->timeout;
+    if (addr) {
+        connect(*addr, conn_timeout);
+        return;
+    }
+
+    // request waits for the resolve only if it's sent at once, otherwise user might write its body to connection not started yet
+    bool socks = request->proxy && request->proxy->scheme() == "socks5";
+    if (_pool && _pool->_dns.enabled() && !socks && !request->chunked && !request->form.size()) {
+        _resolving = _pool->_dns.resolve(_netloc.host, _netloc.port, request->tcp_hints, [this, request](auto& addrs, auto& err) {
+            on_resolved(request, addrs, err);
+        });
+        return;
+    }
+
+    connect(_netloc.host, _netloc.port, conn_timeout, request->tcp_hints);
+    race(request);
+}
+
+// called synchronously from establish() if addresses are cached
+void Client::on_resolved (const RequestSP& request, const DnsCache::Addrs& addrs, const ErrorCode& err) {
+    _resolving = nullptr;
+    if (_request) _request->timings.dns = Clock::now();
+    if (err) {
+        HOLD_ON(this);
+        if (_request) cancel(nest_error(errc::connect_error, err));
+        else if (_pool && _free) _pool->drop_idle(this, false); // prewarmed connection failed
+        return;
+    }
+
+    auto conn_timeout = request->connect_timeout ? request->connect_timeout : request->timeout;
+    _addrs           = addrs;
+    _next_addr       = 1;
+    _connect_request = request;
+    connect(addrs.front(), conn_timeout);
+    race(request);
+    if (_request) send_request(_request);
+}
+
+// if connection takes longer than connect_attempt_delay, other addresses of the host are tried in parallel (RFC 8305)
+void Client::race (const RequestSP& request) {
+    if (_free) return; // prewarmed connection, nobody is waiting for it
+    if (!request->connect_attempt_delay || (request->proxy && request->proxy->scheme() == "socks5")) return;
+    if (request->chunked || request->form.size()) return; // request is resent to the winner, body is not kept
+    if (_addrs.size() == 1) return; // nothing to race with
+    if (!_race_timer) {
+        _race_timer = new Timer(loop());
+        _race_timer->event.add([this](auto&) { start_race(); });
+    }
+    _race_timer->once(request->connect_attempt_delay);
+}
+
+// also started at once if primary connection fails before connect_attempt_delay
+void Client::start_race () {
+    _race_timer->stop();
+    auto& request = _request;
+    if (!request) return;
+    auto timeout = request->connect_timeout ? request->connect_timeout : request->timeout;
+    if (timeout) {
+        auto elapsed = loop()->now() - _connect_start;
+        timeout = elapsed < timeout ? timeout - elapsed : 1;
+    }
+    auto cb = [this](auto& addr, auto& err) { on_race_result(addr, err); };
+    if (_addrs.size()) _eyeballs = new HappyEyeballs(loop(), _addrs, request->connect_attempt_delay, timeout, cb);
+    else _eyeballs = new HappyEyeballs(loop(), _netloc.host, _netloc.port, request->tcp_hints, request->connect_attempt_delay, timeout, cb);
+}
+
+// the next resolved address is tried when connection fails, the race does it by itself if it's on
+bool Client::connect_next () {
+    if (!_connect_request || _next_addr >= _addrs.size()) return false;
+    auto request = std::move(_connect_request);
+    auto addrs   = std::move(_addrs);
+    auto next    = _next_addr;
+    panda_log_info("trying next address " << addrs[next]);
+    auto req = _request;
+    drop_connection();
+    establish(request, request->netloc(), &addrs[next]);
+    _addrs           = std::move(addrs);
+    _next_addr       = next + 1;
+    _connect_request = std::move(request);
+    if (req) resend(req);
+    return true;
+}
+
+void Client::stop_race () {
+    _eyeballs = nullptr;
+    if (_race_timer) _race_timer->stop();
+}
+
+void Client::on_race_result (const net::SockAddr& addr, const ErrorCode& err) {
+    HOLD_ON(this);
+    _eyeballs = nullptr;
+    auto connect_error = _connect_error;
+    _connect_error = {};
+    if (!_request || connected()) return;
+    if (err) return cancel(nest_error(errc::connect_error, connect_error ? connect_error : err));
+
+    panda_log_info("connection race is won by " << addr);
+    auto req = _request;
+    drop_connection();
+    establish(req, req->netloc(), &addr);
+    resend(req);
+}
+
+// nothing has been received on the failed connection, so the request and those pipelined after it are just sent again
+void Client::resend (const RequestSP& req) {
+    write_request(req);
+    for (auto& p : _pipeline) write_request(p.request);
+    read_start();
+}
+
+// called by OpenSSL when server issues a session (during handshake for TLS <= 1.2, after it for TLS 1.3)
+int Client::on_new_tls_session (SSL* ssl, SSL_SESSION* session) {
+    auto client = static_cast<Client*>(SSL_get_ex_data(ssl, tls_ex_index()));
+    if (!client || !client->_pool || !client->_tls_key) return 0; // session is freed by OpenSSL
+    client->_pool->_tls_sessions.store(client->_tls_key, session);
+    return 1;
+}
+
+// handshake starts as soon as TCP connection is established, it's the only way to know that moment for secure connections
+void Client::on_tls_info (const SSL* ssl, int where, int) {
+    if (!(where & SSL_CB_HANDSHAKE_START)) return;
+    auto client = static_cast<Client*>(SSL_get_ex_data(ssl, tls_ex_index()));
+    if (!client || !client->_request || !client->connecting()) return; // TLS 1.3 post-handshake messages also start a "handshake"
+    client->_request->timings.connected = Clock::now();
+}
+
+// client side session cache is off by default, sessions are delivered via callback and we keep them ourselves
+void Client::setup_ssl_context (SSL_CTX* ctx) {
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, on_new_tls_session);
+}
+
+void Client::resume_tls_session (SSL* ssl, const NetLoc& netloc) {
+    if (!_pool || !_pool->_tls_sessions.max_count()) {
+        _tls_key.clear();
+        return;
+    }
+
+    // user's contexts are not altered here, they take part only if prepared by setup_ssl_context()
+    auto ctx = SSL_get_SSL_CTX(ssl);
+    if (SSL_CTX_sess_get_new_cb(ctx) != on_new_tls_session) {
+        _tls_key.clear();
+        return;
+    }
+
+    _tls_key = TlsSessionCache::key(netloc.host, netloc.port, ctx);
+    if (auto session = _pool->_tls_sessions.take(_tls_key)) {
+        SSL_set_session(ssl, session);
+        SSL_SESSION_free(session);
+    }
+}
+
+void Client::write_request (const RequestSP& request) {
+    using namespace panda::protocol::http;
+    if (request->compression_prefs == static_cast<std::uint8_t>(Compression::IDENTITY) && !request->headers.has("Accept-Encoding")) {
+        request->allow_compression(Compression::GZIP);
+    }
+    if (request->_span) request->headers.set("traceparent", request->_span->context.traceparent());
+
+    auto data = request->to_vector();
+    write(data.begin(), data.end());
+}
+
+// only idempotent requests without streamed body, as they are resent if connection is lost before they are answered
+bool Client::pipelinable (const RequestSP& req) {
+    auto method = req->method_raw();
+    if (method != Request::Method::Get && method != Request::Method::Head && method != Request::Method::Options) return false;
+    return !req->chunked && !req->form.size() && req->keep_alive();
+}
+
+bool Client::can_pipeline () const {
+    return _request && _request->_transfer_completed && _request->keep_alive() && !_in_redirect && !_resolving;
+}
+
+void Client::pipeline (const RequestSP& request) {
+    assert(can_pipeline() && pipelinable(request));
+    panda_log_info("pipelined request:\n" << request->to_string());
+
+    request->_client = this;
+    if (!request->uri->scheme()) request->uri->scheme("http");
+    if (request->timeout) request->ensure_timer_active(loop());
+
+    if (request->timings.dequeue(Clock::now())) request->trace_start();
+    write_request(request);
+    request->_transfer_completed = true;
+    _pipeline.push_back({request, false});
+}
+
+// makes the next pipelined request active, its response is the next one in the stream
+bool Client::next_pipelined () {
+    if (!_pipeline.size()) return false;
+    auto& next = _pipeline.front();
+    _request  = std::move(next.request);
+    _canceled = next.canceled;
+    _pipeline.pop_front();
+    _received = false;
+    _parser.set_context_request(_request);
+    return true;
+}
+
+// requests were sent, but connection is lost before they were answered. As they are idempotent, they go to pool once again
+void Client::requeue (Pipeline& pipeline) {
+    for (auto& p : pipeline) {
+        if (p.canceled) continue;
+        auto req = std::move(p.request);
+        req->cleanup_after_redirect();
+        if (_pool) _pool->request(req);
+        else       req->finish_and_notify({}, errc::pipeline_canceled);
+    }
+    pipeline.clear();
+}
+
+void Client::cancel_request (Request* req, const ErrorCode& err) {
+    if (req == _request) return cancel(err);
+    for (auto& p : _pipeline) {
+        if (p.request != req || p.canceled) continue;
+        // request has already been sent, so its response can only be skipped when it arrives.
+        // User's request is released at once, as it may be resubmitted meanwhile.
+        p.request  = stand_in(req);
+        p.canceled = true;
+        req->finish_and_notify({}, err);
+        return;
+    }
+}
+
+// parses the response of a canceled pipelined request in place of it, only the method and version matter for parsing
+RequestSP Client::stand_in (const Request* req) {
+    RequestSP ret = new Request();
+    ret->_method             = req->_method;
+    ret->uri                 = req->uri;
+    ret->http_version        = req->http_version;
+    ret->_transfer_completed = true;
+    return ret;
+}
+
 void Client::send_chunk (const RequestSP& req, const string& chunk) {
     assert(_request == req);
     if (!chunk) return;
@@ -138,28 +392,73 @@ void Client::cancel (const ErrorCode& err) {
 }
 
 void Client::on_connect (const ErrorCode& err, const ConnectRequestSP&) {
-    if (_request && err) cancel(nest_error(errc::connect_error, err));
+    if (!err) {
+        stop_race(); // primary connection has won
+        _connect_request = nullptr;
+        if (_request) {
+            auto& t = _request->timings;
+            auto now = Clock::now();
+            if (is_secure()) t.tls = now;
+            if (t.connected == RequestTimings::time_point()) t.connected = now;
+        }
+        if (_tls_key && _pool) {
+            auto& stats = _pool->_tls_sessions._stats;
+            if (SSL_session_reused(get_ssl())) ++stats.hits;
+            else                               ++stats.misses;
+        }
+        return;
+    }
+    if (_request && _race_timer && _race_timer->active()) start_race(); // no need to wait any longer
+    if (!_eyeballs && !(err & std::errc::operation_canceled) && connect_next()) return;
+    if (_request && _eyeballs) { // the race decides
+        _connect_error = err;
+        return _eyeballs->primary_failed(err);
+    }
+    if (_request) cancel(nest_error(errc::connect_error, err));
+    else if (_pool && _free) { // not a connection being dropped with the request temporarily detached
+        HOLD_ON(this);
+        _pool->drop_idle(this, false); // prewarmed connection failed
+    }
 }
 
 void Client::on_write (const ErrorCode& err, const WriteRequestSP&) {
-    if (_request && err) cancel(err);
+    if ((racing() || _connect_request) && !connected()) return; // writes are canceled with failed connection, the race or the next address decides
+    if (_request && err && !retry(err)) cancel(err);
+    if (!err && !write_queue_size()) mark_written();
+}
+
+// everything queued so far is written, so are the requests whose transfer is completed
+void Client::mark_written () {
+    auto now = Clock::now();
+    auto mark = [now](const RequestSP& req) {
+        if (req && req->_transfer_completed && req->timings.written == RequestTimings::time_point()) req->timings.written = now;
+    };
+    mark(_request);
+    for (auto& p : _pipeline) mark(p.request);
 }
 
-void Client::timed_out () {
+void Client::timed_out (Request* req) {
     HOLD_ON(this);
     auto err = make_error_code(std::errc::timed_out);
-    cancel(connecting() ? nest_error(errc::connect_error, err) : err);
+    if (req != _request) return cancel_request(req, err);
+    cancel(connecting() || _resolving ? nest_error(errc::connect_error, err) : err);
 }
 
 void Client::on_read (string& buf, const ErrorCode& err) {
-    if (err) return cancel(err);
-    panda_log_debug("read (" << buf.size() << " bytes):\n" << buf);
+    if (err) {
+        if (!retry(err)) cancel(err);
+        return;
+    }
+    panda_log_debug("read " << buf.size() << " bytes");
+    if (buf) _received = true;
+    auto now = Clock::now();
     while (buf) {
         if (!_parser.context_request()) {
-            panda_log_notice("unexpected buffer: " << buf);
+            panda_log_notice("unexpected " << buf.size() << " bytes without request");
             drop_connection();
             break;
         }
+        if (_request->timings.first_byte == RequestTimings::time_point()) _request->timings.first_byte = now;
 
         auto result = _parser.parse_shift(buf);
         _response = static_pointer_cast<Response>(result.response);
@@ -174,7 +473,7 @@ void Client::on_read (string& buf, const ErrorCode& err) {
 
         if (result.state != protocol::http::State::done) {
             panda_log_debug("got part, body not finished");
-            if (_response->code == 100) continue;
+            if (_response->code == 100 || _canceled) continue;
             if (_request->follow_redirect && is_redirect(_response->code)) continue;
             _request->partial_event(_request, _response, {});
             continue;
@@ -190,11 +489,11 @@ void Client::analyze_request () {
     panda_log_debug("analyze, (uncompressed) response = " << _response->to_string(nullptr));
 
     if (_response->code == 100) {
-        _request->continue_event(_request);
+        if (!_canceled) _request->continue_event(_request);
         _response.reset();
         return;
     }
-    else if (_request->follow_redirect && is_redirect(_response->code)) {
+    else if (!_canceled && _request->follow_redirect && is_redirect(_response->code)) {
         if (!_request->redirection_limit) return cancel(errc::unexpected_redirect);
         if (++_request->_redirection_counter > _request->redirection_limit) return cancel(errc::redirection_limit);
 
@@ -251,16 +550,25 @@ void Client::analyze_request () {
         auto req = std::move(_request);
         auto res = std::move(_response);
         req->_client = nullptr;
-        if (!res->keep_alive()) Tcp::reset();
+        Pipeline unanswered;
+        if (!res->keep_alive()) {
+            Tcp::reset();
+            std::swap(unanswered, _pipeline);
+        }
 
         req->cleanup_after_redirect();
-        if (_pool && (netloc.host != _netloc.host || netloc.port != _netloc.port)) {
+        // if there are pipelined requests, redirected one can't be sent on this connection before they are answered
+        if (_pool && (netloc.host != _netloc.host || netloc.port != _netloc.port || _pipeline.size())) {
             panda_log_debug("using pool");
             _last_activity_time = loop()->now();
-            _pool->putback(this);
-            Tcp::weak(true);
+            if (!next_pipelined()) {
+                _pool->putback(this);
+                Tcp::weak(true);
+            }
+            requeue(unanswered);
             _pool->request(req);
         } else {
+            requeue(unanswered);
             panda_log_debug("using self again");
             request(req);
         }
@@ -270,7 +578,50 @@ void Client::analyze_request () {
     finish_request({});
 }
 
+// Connection is lost before anything of the response is received. If it's a keep-alive connection which has already served requests,
+// server has most likely closed it as idle while the request was on its way, so it is resent at once; a lost new connection means
+// trouble on server's side, so there is a backoff. Requests pipelined after this one are requeued as usual.
+bool Client::retry (const ErrorCode& err) {
+    auto req = _request;
+    if (!req || _received || _canceled || _in_redirect || !req->retriable()) return false;
+    if (req->_retries + 1 >= req->retry.max_attempts) return false;
+    bool stale = _nserved;
+    if (!stale && !req->retry.new_connections) return false;
+
+    ++req->_retries;
+    panda_log_notice("connection to " << _netloc << " is lost (" << err << "), resending request (attempt " << req->_retries + 1 << ")");
+    HOLD_ON(this);
+    _request = nullptr;
+    _response.reset();
+    _parser.reset();
+    req->cleanup_after_redirect();
+
+    Pipeline unanswered;
+    std::swap(unanswered, _pipeline);
+    drop_connection();
+    _last_activity_time = loop()->now();
+    if (_pool) _pool->putback(this);
+    requeue(unanswered);
+
+    uint64_t delay = stale ? 0 : req->retry.backoff << (req->_retries - 1);
+    PoolSP   pool  = _pool;
+    ClientSP self  = this;
+    auto resend = [req, pool, self] {
+        if (pool) pool->request(req);
+        else      self->request(req);
+    };
+    if (delay) req->schedule_retry(loop(), delay, resend);
+    else       resend();
+    return true;
+}
+
 void Client::drop_connection () {
+    stop_race();
+    _connect_request = nullptr; // its connection is not going to be resumed on the next address
+    if (_resolving) {
+        _resolving->cancel();
+        _resolving = nullptr;
+    }
     auto req = std::move(_request); // temporarily remove _request to suppress cancel() from on_connect/on_write with error
     Tcp::reset();
     _request = std::move(req);
@@ -279,12 +630,21 @@ void Client::drop_connection () {
 void Client::finish_request (const ErrorCode& _err) {
     auto req = std::move(_request);
     auto res = std::move(_response);
+    bool canceled = _canceled; // user has already been notified
+    _canceled = false;
 
     auto err = _err;
-    if (!err && !req->_transfer_completed) err = errc::transfer_aborted;
+    if (!err && !canceled && !req->_transfer_completed) err = errc::transfer_aborted;
 
-    if (err || !res->keep_alive() || !req->keep_alive()) drop_connection();
-    else Tcp::weak(true);
+    Pipeline unanswered;
+    if (err || !res->keep_alive() || !req->keep_alive()) {
+        drop_connection();
+        std::swap(unanswered, _pipeline);
+    }
+    else {
+        ++_nserved;
+        if (!next_pipelined()) Tcp::weak(true);
+    }
 
     if (_form_field >= 0) {
         req->form[_form_field]->stop();
@@ -292,18 +652,27 @@ void Client::finish_request (const ErrorCode& _err) {
     }
 
     _last_activity_time = loop()->now();
-    if (_pool) _pool->putback(this);
+    if (_pool && !_request) _pool->putback(this);
+    requeue(unanswered);
 
-    req->finish_and_notify(res, err);
+    if (!canceled) req->finish_and_notify(res, err);
 }
 
 void Client::on_eof () {
     panda_log_info("got eof");
     if (!_request) {
+        HOLD_ON(this);
         Tcp::reset();
+        if (_pool && _free) _pool->drop_idle(this, true);
         return;
     }
 
+    if (retry(make_error_code(std::errc::connection_reset))) return;
+
+    // requests pipelined after the current one will never be answered on this connection
+    Pipeline unanswered;
+    std::swap(unanswered, _pipeline);
+
     auto result = _parser.eof();
     _response = static_pointer_cast<Response>(result.response);
     _response->_is_done = true;
@@ -313,6 +682,8 @@ void Client::on_eof () {
     } else {
         analyze_request();
     }
+
+    requeue(unanswered);
 }
 
 void Client::send_chunk(const Chunk &chunk) noexcept {
@@ -345,29 +716,10 @@ void Client::form_file_complete(const ErrorCode& ec)  {
     send_form();
 }
 
-static SslContext& _default_ssl_context()
-{
-    thread_local SslContext instance = SslContext::attach(SSL_CTX_new(TLS_client_method()));
-    return instance;
-}
-
-
-static SslContext& _verify_ssl_context()
-{
-    thread_local SslContext instance;
-    if (!instance) {
-        instance = SslContext::attach(SSL_CTX_new(TLS_client_method()));
-        bool ok = SSL_CTX_set_default_verify_paths(instance);
-        if (!ok) {
-            throw HttpError("can not set ssl certificate default verify paths");
-        }
-        SSL_CTX_set_verify(instance, SSL_VERIFY_PEER, nullptr);
-    }
-    return instance;
-}
-
 SslContext Client::get_default_ssl_context(bool verify) {
-    return verify ? _verify_ssl_context() : _default_ssl_context();
+    SslConfig cfg;
+    cfg.verify = verify;
+    return ssl_context(cfg);
 }
 
 
@@ -2,9 +2,14 @@
 #include "error.h"
 #include "Request.h"
 #include "Form.h"
+#include "DnsCache.h"
+#include "HappyEyeballs.h"
 #include "panda/unievent/SslContext.h"
 #include <panda/unievent/Tcp.h>
 #include <panda/protocol/http/ResponseParser.h>
+#include <deque>
+#include <list>
+#include <openssl/ssl.h>
 
 namespace panda { namespace unievent { namespace http {
 
@@ -17,7 +22,10 @@ extern const string DEFAULT_UA;
 struct Client : Tcp, private ITcpSelfListener {
     Client (const LoopSP& = Loop::default_loop());
 
-    ~Client () { assert(!_request); }
+    ~Client () {
+        assert(!_request);
+        if (_resolving) _resolving->cancel();
+    }
 
     void request (const RequestSP&);
     void cancel  (const ErrorCode& = make_error_code(std::errc::operation_canceled));
@@ -30,6 +38,10 @@ struct Client : Tcp, private ITcpSelfListener {
 
     static SslContext get_default_ssl_context(bool verify);
 
+    // prepares context for use by clients (TLS session collection for Pool), applied to contexts from ssl_context() when built.
+    // User's contexts are left as is, call it once before the context is used to let Pool resume their sessions.
+    static void setup_ssl_context (SSL_CTX*);
+
 protected:
     Client (Pool*);
 
@@ -37,26 +49,78 @@ private:
     friend Pool; friend Request; friend IFormItem; friend FormFile;
     using ResponseParser = protocol::http::ResponseParser;
 
+    struct Pipelined {
+        RequestSP request;
+        bool      canceled; // response will be read and skipped, request is a stand-in then (see stand_in())
+    };
+    using Pipeline = std::deque<Pipelined>;
+    using PoolPos  = std::list<ClientSP>::iterator;
+    using IdlePos  = std::list<Client*>::iterator;
+
     Pool*          _pool = nullptr;
+    PoolPos        _pool_pos; // in pool's free or busy list
+    string         _tls_key;  // in pool's TLS session cache, set while connection is secure and cache is enabled
+    IdlePos        _idle_pos; // in pool's idle list, valid if _free
+    bool           _free = false; // in pool's free list
     NetLoc         _netloc;
     RequestSP      _request;
     ResponseSP     _response;
     ResponseParser _parser;
+    Pipeline       _pipeline; // requests sent after _request, waiting for their responses (only via Pool)
     uint64_t       _last_activity_time = 0;
     bool           _in_redirect = false;
     bool           _redirect_canceled = false;
+    bool           _canceled = false; // _request was canceled by user while being pipelined
+    bool           _received = false; // anything of _request's response
+    uint32_t       _nserved  = 0;     // requests answered on the current connection
     int32_t        _form_field = -1;
 
+    DnsCache::QuerySP _resolving;         // host is being resolved via pool's cache, connection is started when it's done
+    HappyEyeballsSP   _eyeballs;          // connection race, while connecting
+    TimerSP           _race_timer;        // starts the race when connection takes longer than connect_attempt_delay
+    DnsCache::Addrs   _addrs;             // of the host being connected to, if resolved via pool's cache
+    size_t            _next_addr = 0;     // in _addrs, tried if connection fails and there is no race
+    RequestSP         _connect_request;   // connection to _addrs is established with its settings
+    uint64_t          _connect_start = 0; // [loop time ms]
+    ErrorCode         _connect_error;     // of the primary connection, while the race goes on
+
     void on_connect (const ErrorCode&, const ConnectRequestSP&) override;
     void on_write   (const ErrorCode&, const WriteRequestSP&) override;
     void on_read    (string& buf, const ErrorCode& err) override;
     void on_eof     () override;
 
-    void timed_out();
+    void establish      (const RequestSP&, NetLoc&&, const net::SockAddr* = nullptr);
+    void on_resolved    (const RequestSP&, const DnsCache::Addrs&, const ErrorCode&);
+    void race           (const RequestSP&);
+    void start_race     ();
+    void stop_race      ();
+    bool racing         () const { return _eyeballs || (_race_timer && _race_timer->active()); }
+    void on_race_result (const net::SockAddr&, const ErrorCode&);
+    bool connect_next   ();
+    void resend         (const RequestSP&);
+
+    void        resume_tls_session (SSL*, const NetLoc&);
+    static int  on_new_tls_session (SSL*, SSL_SESSION*);
+    static void on_tls_info        (const SSL*, int where, int ret);
+
+    void send_request   (const RequestSP&);
+    void write_request  (const RequestSP&);
+    void mark_written   ();
+    void cancel_request (Request*, const ErrorCode&);
+    void timed_out      (Request*);
+
+    static bool      pipelinable (const RequestSP&);
+    static RequestSP stand_in    (const Request*);
+
+    bool can_pipeline   () const;
+    void pipeline       (const RequestSP&);
+    bool next_pipelined ();
+    void requeue        (Pipeline&);
 
     void send_chunk       (const RequestSP&, const string&);
     void send_final_chunk (const RequestSP&, const string&);
 
+    bool retry           (const ErrorCode&);
     void drop_connection ();
     void analyze_request ();
     void finish_request  (const ErrorCode&);
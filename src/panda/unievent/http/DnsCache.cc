@@ -0,0 +1,169 @@
+#include "DnsCache.h"
+#include <cstdio>
+#include <panda/log.h>
+#include <panda/unievent/Resolver.h>
+
+namespace panda { namespace unievent { namespace http {
+
+namespace {
+    struct LoopResolver : DnsCache::IResolver {
+        LoopSP loop;
+
+        LoopResolver (const LoopSP& loop) : loop(loop) {}
+
+        void resolve (const string& host, uint16_t port, const AddrInfoHints& hints, const Callback& cb) override {
+            // unievent's own cache is bypassed, otherwise refreshes would return the same stale addresses
+            loop->resolver()->resolve()->node(host)->port(port)->hints(hints)->use_cache(false)->on_resolve(
+                [cb](const AddrInfo& ai, const std::error_code& err, const Resolver::RequestSP&) {
+                    DnsCache::Addrs addrs;
+                    if (!err) for (auto cur = ai; cur; cur = cur.next()) addrs.push_back(cur.addr());
+                    cb(addrs, err, 0);
+                }
+            )->run();
+        }
+    };
+}
+
+static string make_key (const string& host, uint16_t port, const AddrInfoHints& hints) {
+    char buf[64];
+    auto len = snprintf(buf, sizeof(buf), ":%u:%d:%d:%d:%d", unsigned(port), hints.family, hints.socktype, hints.protocol, hints.flags);
+    string ret = host;
+    ret += string(buf, len);
+    return ret;
+}
+
+DnsCache::DnsCache (const LoopSP& loop, const Config& cfg) : _loop(loop), _alive(std::make_shared<bool>(true)) {
+    config(cfg);
+}
+
+void DnsCache::config (const Config& cfg) {
+    _cfg = cfg;
+    if (!_cfg.ttl) clear();
+    evict();
+}
+
+DnsCache::QuerySP DnsCache::resolve (const string& host, uint16_t port, const AddrInfoHints& hints, const Callback& cb) {
+    auto key = make_key(host, port, hints);
+    auto now = _loop->now();
+
+    auto it = _index.find(key);
+    if (it != _index.end()) {
+        auto& e = *it->second;
+        _lru.splice(_lru.begin(), _lru, it->second);
+
+        if (e.error) {
+            if (now < e.expires) {
+                ++_stats.negative_hits;
+                QuerySP query = new Query();
+                query->callback = cb;
+                auto err = e.error;
+                _loop->delay([query, err]{
+                    if (query->callback) query->callback({}, err);
+                });
+                return query;
+            }
+        }
+        else if (now < e.expires) {
+            ++_stats.hits;
+            ++e.hits;
+            // hot entry is refreshed before it expires, so its users never wait for resolver
+            bool hot = _cfg.prefetch_hits && e.hits >= _cfg.prefetch_hits && e.expires - now <= e.ttl / 4;
+            if (hot && !_pending.count(key)) {
+                ++_stats.prefetches;
+                panda_log_debug("dns cache: prefetching " << host);
+                start(key, host, port, hints);
+            }
+            auto addrs = e.addrs;
+            cb(addrs, {});
+            return nullptr;
+        }
+        else if (now < e.expires + _cfg.stale_ttl) {
+            ++_stats.stale_hits;
+            if (!_pending.count(key)) {
+                ++_stats.prefetches;
+                panda_log_debug("dns cache: refreshing stale " << host);
+                start(key, host, port, hints);
+            }
+            auto addrs = e.addrs;
+            cb(addrs, {});
+            return nullptr;
+        }
+
+        _lru.erase(it->second);
+        _index.erase(it);
+    }
+
+    QuerySP query = new Query();
+    query->callback = cb;
+
+    auto pit = _pending.find(key);
+    if (pit != _pending.end()) {
+        ++_stats.coalesced;
+        pit->second.queries.push_back(query);
+        return query;
+    }
+
+    ++_stats.misses;
+    _pending[key].queries.push_back(query);
+    start(key, host, port, hints);
+    return query;
+}
+
+void DnsCache::start (const string& key, const string& host, uint16_t port, const AddrInfoHints& hints) {
+    _pending[key]; // marks resolve in progress, even if nobody waits for it
+
+    auto resolver = _cfg.resolver;
+    if (!resolver) {
+        if (!_default_resolver) _default_resolver.reset(new LoopResolver(_loop));
+        resolver = _default_resolver.get();
+    }
+
+    std::weak_ptr<bool> alive = _alive;
+    resolver->resolve(host, port, hints, [this, alive, key](const Addrs& addrs, const ErrorCode& err, uint64_t ttl) {
+        if (alive.expired()) return;
+        on_result(key, addrs, err, ttl);
+    });
+}
+
+void DnsCache::on_result (const string& key, const Addrs& addrs, const ErrorCode& err, uint64_t ttl) {
+    auto pit = _pending.find(key);
+    if (pit == _pending.end()) return;
+    auto queries = std::move(pit->second.queries);
+    _pending.erase(pit);
+
+    ErrorCode error = err;
+    if (!error && addrs.empty()) error = make_error_code(std::errc::address_not_available);
+
+    auto it = _index.find(key);
+    if (error && it != _index.end() && !it->second->error) {
+        // failed refresh, the old addresses are still served until their stale period ends
+        panda_log_info("dns cache: refresh of " << key << " failed: " << error);
+    }
+    else if (_cfg.ttl) {
+        if (it != _index.end()) {
+            _lru.erase(it->second);
+            _index.erase(it);
+        }
+        if (!ttl) ttl = error ? _cfg.negative_ttl : _cfg.ttl;
+        if (ttl) {
+            _lru.push_front({key, error ? Addrs() : addrs, error, ttl, _loop->now() + ttl, 0});
+            _index.emplace(key, _lru.begin());
+            evict();
+        }
+    }
+
+    for (auto& query : queries) {
+        if (!query->callback) continue;
+        auto cb = std::move(query->callback);
+        cb(addrs, error);
+    }
+}
+
+void DnsCache::evict () {
+    while (_lru.size() > _cfg.max_count) {
+        _index.erase(_lru.back().key);
+        _lru.pop_back();
+    }
+}
+
+}}}
@@ -0,0 +1,105 @@
+#pragma once
+#include "error.h"
+#include <list>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <unordered_map>
+#include <panda/refcnt.h>
+#include <panda/function.h>
+#include <panda/net/sockaddr.h>
+#include <panda/unievent/Loop.h>
+#include <panda/unievent/AddrInfo.h>
+
+namespace panda { namespace unievent { namespace http {
+
+// Pool's cache of resolved host addresses. Fresh entries are served without resolver; expired ones are still served for
+// `stale_ttl` while being refreshed in background; entries which are used often are refreshed before they expire (prefetch).
+// Failures are cached for `negative_ttl`. Concurrent lookups of the same host wait for a single resolve.
+struct DnsCache {
+    using Addrs    = std::vector<net::SockAddr>;
+    using Callback = function<void(const Addrs&, const ErrorCode&)>;
+
+    struct IResolver {
+        using Callback = function<void(const Addrs&, const ErrorCode&, uint64_t ttl)>; // ttl [ms] if known, 0 = use config's
+        // must call back asynchronously
+        virtual void resolve (const string& host, uint16_t port, const AddrInfoHints&, const Callback&) = 0;
+        virtual ~IResolver () {}
+    };
+
+    struct Config {
+        uint64_t   ttl           = 0;     // [ms], 0 = cache is disabled; loop's resolver doesn't know record TTLs, so it's opt-in
+        uint64_t   stale_ttl     = 30000; // [ms] how long an expired entry may be served while it's being refreshed
+        uint64_t   negative_ttl  = 5000;  // [ms]
+        uint32_t   prefetch_hits = 5;     // entry used that many times is refreshed during the last quarter of its ttl, 0 = never
+        size_t     max_count     = 10000;
+        IResolver* resolver      = nullptr; // unievent's loop resolver (with its own cache off) if not set
+        Config () {}
+    };
+
+    struct Stats {
+        uint64_t hits          = 0;
+        uint64_t stale_hits    = 0;
+        uint64_t negative_hits = 0;
+        uint64_t misses        = 0;
+        uint64_t coalesced     = 0; // lookups which waited for the resolve started by another one
+        uint64_t prefetches    = 0; // background refreshes of stale or hot entries
+    };
+
+    struct Query : Refcnt {
+        void cancel () { callback = nullptr; }
+    private:
+        friend DnsCache;
+        Callback callback;
+    };
+    using QuerySP = iptr<Query>;
+
+    DnsCache (const LoopSP&, const Config& = {});
+
+    const Config& config () const { return _cfg; }
+    void          config (const Config&);
+
+    bool enabled () const { return _cfg.ttl; }
+
+    size_t       count () const { return _lru.size(); }
+    const Stats& stats () const { return _stats; }
+
+    void clear () { _lru.clear(); _index.clear(); }
+
+    // Calls back synchronously and returns nullptr if addresses are in cache, otherwise returns the query which is answered later
+    // (errors are always reported asynchronously).
+    QuerySP resolve (const string& host, uint16_t port, const AddrInfoHints&, const Callback&);
+
+private:
+    struct Entry {
+        string    key;
+        Addrs     addrs;
+        ErrorCode error;
+        uint64_t  ttl;
+        uint64_t  expires; // [loop time ms]
+        uint32_t  hits;    // since the last resolve
+    };
+    using Lru = std::list<Entry>;
+
+    struct Pending {
+        std::vector<QuerySP> queries;
+    };
+
+    LoopSP                                    _loop;
+    Config                                    _cfg;
+    Lru                                       _lru; // most recently used first
+    std::unordered_map<string, Lru::iterator> _index;
+    std::unordered_map<string, Pending>       _pending;
+    Stats                                     _stats;
+    std::unique_ptr<IResolver>                _default_resolver;
+    std::shared_ptr<bool>                     _alive; // resolves in progress may outlive us
+
+    void start     (const string& key, const string& host, uint16_t port, const AddrInfoHints&);
+    void on_result (const string& key, const Addrs&, const ErrorCode&, uint64_t ttl);
+    void evict     ();
+
+    DnsCache (const DnsCache&) = delete;
+    DnsCache& operator= (const DnsCache&) = delete;
+};
+
+}}}
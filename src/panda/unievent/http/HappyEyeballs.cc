@@ -0,0 +1,123 @@
+#include "HappyEyeballs.h"
+#include <algorithm>
+#include <panda/log.h>
+
+namespace panda { namespace unievent { namespace http {
+
+HappyEyeballs::HappyEyeballs (const LoopSP& loop, uint64_t delay, uint64_t timeout, const Callback& cb)
+    : _loop(loop), _delay(delay), _deadline(timeout ? loop->now() + timeout : 0), _callback(cb)
+{
+    _timer = new Timer(loop);
+    _timer->event.add([this](auto&) {
+        _waiting = false;
+        attempt();
+    });
+}
+
+HappyEyeballs::HappyEyeballs (const LoopSP& loop, const Addrs& addrs, uint64_t delay, uint64_t timeout, const Callback& cb)
+    : HappyEyeballs(loop, delay, timeout, cb)
+{
+    _resolved = true;
+    set_addrs(addrs);
+    attempt();
+}
+
+HappyEyeballs::HappyEyeballs (const LoopSP& loop, const string& host, uint16_t port, const AddrInfoHints& hints, uint64_t delay,
+                              uint64_t timeout, const Callback& cb)
+    : HappyEyeballs(loop, delay, timeout, cb)
+{
+    _resolve = loop->resolver()->resolve()->node(host)->port(port)->hints(hints)->on_resolve(
+        [this](const AddrInfo& ai, const std::error_code& err, const Resolver::RequestSP&) { on_resolve(ai, err); }
+    )->run();
+}
+
+// alternatives start with the other family than primary's and then alternate
+void HappyEyeballs::set_addrs (const Addrs& addrs) {
+    if (addrs.empty()) return;
+    Addrs same, other;
+    auto family = addrs.front().family();
+    for (auto& addr : addrs) (addr.family() == family ? same : other).push_back(addr);
+    for (size_t i = 0; i < std::max(same.size(), other.size()); ++i) {
+        if (i < other.size()) _addrs.push_back(other[i]);
+        if (i + 1 < same.size()) _addrs.push_back(same[i + 1]);
+    }
+}
+
+void HappyEyeballs::on_resolve (const AddrInfo& ai, const std::error_code& err) {
+    _resolve  = nullptr;
+    _resolved = true;
+    if (!_callback) return;
+    if (err) _error = err;
+    else {
+        Addrs addrs;
+        for (auto cur = ai; cur; cur = cur.next()) addrs.push_back(cur.addr());
+        set_addrs(addrs);
+    }
+    attempt();
+}
+
+void HappyEyeballs::primary_failed (const ErrorCode& err) {
+    _primary_failed = true;
+    _error   = err;
+    _waiting = false;
+    attempt();
+}
+
+void HappyEyeballs::attempt () {
+    if (!_callback || !_resolved) return;
+
+    if (_next < _addrs.size()) {
+        if (_waiting) return;
+        auto addr = _addrs[_next++];
+        panda_log_debug("happy eyeballs: trying " << addr);
+        TcpSP probe = new Tcp(_loop);
+        probe->connect_event.add([this, addr](auto&, auto& err, auto&) { on_probe(addr, err); });
+        _probes.push_back(probe);
+        ++_active;
+        _waiting = true;
+        _timer->once(_delay);
+        auto now = _loop->now();
+        probe->connect(addr, !_deadline ? 0 : _deadline > now ? _deadline - now : 1); // the primary's deadline is shared
+        return;
+    }
+
+    // nothing else to try
+    if (_primary_failed && !_active) finish({}, _error);
+}
+
+void HappyEyeballs::on_probe (const net::SockAddr& addr, const ErrorCode& err) {
+    if (!_callback) return;
+    if (!err) return finish(addr, {});
+    panda_log_debug("happy eyeballs: " << addr << " failed: " << err);
+    --_active;
+    _error   = err;
+    _waiting = false; // the next attempt starts right away
+    attempt();
+}
+
+void HappyEyeballs::finish (const net::SockAddr& addr, const ErrorCode& err) {
+    HappyEyeballsSP hold = this; // callback usually drops us
+    auto cb = std::move(_callback);
+    stop();
+    cb(addr, err);
+}
+
+void HappyEyeballs::stop () {
+    _callback = nullptr;
+    if (_resolve) {
+        auto req = std::move(_resolve);
+        req->cancel();
+    }
+    if (!_timer) return;
+    _timer->stop();
+    for (auto& p : _probes) {
+        p->connect_event.remove_all();
+        p->reset();
+    }
+    // we might be inside of the timer's or a probe's callback, so they die on the next loop iteration
+    auto timer  = std::move(_timer);
+    auto probes = std::move(_probes);
+    _loop->delay([timer, probes]{});
+}
+
+}}}
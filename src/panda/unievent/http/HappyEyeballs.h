@@ -0,0 +1,61 @@
+#pragma once
+#include "error.h"
+#include <vector>
+#include <panda/refcnt.h>
+#include <panda/function.h>
+#include <panda/unievent/Tcp.h>
+#include <panda/unievent/Timer.h>
+#include <panda/unievent/Resolver.h>
+
+namespace panda { namespace unievent { namespace http {
+
+// Connection racing (RFC 8305) for a client connection which has been connecting to the primary address for a while already.
+// Other addresses of the host are tried in parallel, alternating address families and starting the next attempt every `delay`
+// or as soon as the previous one fails. The first address which accepts connection wins, other attempts are canceled. Racing
+// connections are only probes, the client is expected to reconnect to the winner. Every probe is given what is left of `timeout`.
+struct HappyEyeballs : Refcnt {
+    using Addrs    = std::vector<net::SockAddr>;
+    using Callback = function<void(const net::SockAddr& winner, const ErrorCode& err)>; // err is set if every attempt failed
+
+    // addresses of the host are known, the first one is primary's
+    HappyEyeballs (const LoopSP&, const Addrs&, uint64_t delay, uint64_t timeout, const Callback&);
+
+    // host is resolved by the loop's resolver, primary connection is assumed to go to the first address
+    HappyEyeballs (const LoopSP&, const string& host, uint16_t port, const AddrInfoHints&, uint64_t delay, uint64_t timeout, const Callback&);
+
+    ~HappyEyeballs () { stop(); }
+
+    // primary connection has failed, the race goes on without delays; it fails when all alternatives fail
+    void primary_failed (const ErrorCode&);
+
+    void stop ();
+
+private:
+    using Probes = std::vector<TcpSP>;
+
+    LoopSP                _loop;
+    uint64_t              _delay;
+    uint64_t              _deadline;     // [loop time ms], 0 = none
+    Callback              _callback;
+    Resolver::RequestSP   _resolve;
+    TimerSP               _timer;
+    Addrs                 _addrs;        // alternatives to the primary address, in order of attempts
+    size_t                _next = 0;
+    size_t                _active = 0;  // probes being connected
+    Probes                _probes;
+    bool                  _resolved = false;
+    bool                  _waiting  = false; // for the delay before the next attempt
+    bool                  _primary_failed = false;
+    ErrorCode             _error;
+
+    HappyEyeballs (const LoopSP&, uint64_t delay, uint64_t timeout, const Callback&);
+
+    void set_addrs  (const Addrs&);
+    void on_resolve (const AddrInfo&, const std::error_code&);
+    void attempt    ();
+    void on_probe   (const net::SockAddr&, const ErrorCode&);
+    void finish     (const net::SockAddr&, const ErrorCode&);
+};
+using HappyEyeballsSP = iptr<HappyEyeballs>;
+
+}}}
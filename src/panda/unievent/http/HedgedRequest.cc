@@ -0,0 +1,142 @@
+#include "HedgedRequest.h"
+#include <algorithm>
+#include <panda/log.h>
+
+namespace panda { namespace unievent { namespace http {
+
+HedgedRequest::HedgedRequest (Pool* pool, const RequestSP& req, uint64_t delay) : _pool(pool), _request(req), _delay(delay) {}
+
+// only idempotent requests without streamed body, as the same request is sent several times
+bool HedgedRequest::hedgeable (const RequestSP& req) {
+    if (!req->hedge.delay && !req->hedge.percentile) return false;
+    auto method = req->method_raw();
+    if (method != Request::Method::Get && method != Request::Method::Head && method != Request::Method::Options) return false;
+    return !req->chunked && !req->form.size();
+}
+
+ClientSP HedgedRequest::start () {
+    if (_request->hedge.max_hedges) {
+        _timer = new Timer(_pool->loop());
+        _timer->event.add([this](auto&){ on_timer(); });
+        _timer->once(_delay);
+    }
+    return attempt(false);
+}
+
+RequestSP HedgedRequest::make_copy () {
+    auto& src = *_request;
+    RequestSP ret = new Request();
+    ret->_hedge_copy           = true;
+    ret->_method               = src._method;
+    ret->uri                   = new URI(*src.uri); // copy might be redirected
+    ret->http_version          = src.http_version;
+    ret->headers               = src.headers;
+    ret->body                  = src.body;
+    ret->cookies               = src.cookies;
+    ret->compression_prefs     = src.compression_prefs;
+    ret->timeout               = 0; // request's own timer counts
+    ret->connect_timeout       = src.connect_timeout ? src.connect_timeout : src.timeout;
+    ret->connect_attempt_delay = src.connect_attempt_delay;
+    ret->follow_redirect       = src.follow_redirect;
+    ret->tcp_nodelay           = src.tcp_nodelay;
+    ret->redirection_limit     = src.redirection_limit;
+    ret->ssl_ctx               = src.ssl_ctx;
+    ret->ssl_check_cert        = src.ssl_check_cert;
+    ret->proxy                 = src.proxy;
+    ret->proxy_resolve         = src.proxy_resolve;
+    ret->tcp_hints             = src.tcp_hints;
+    ret->retry                 = src.retry;
+    if (src._span) ret->headers.remove("traceparent"); // copies are children of the request's span, see attempt()
+
+    HedgedRequestSP self = this;
+    Request* copy = ret.get();
+    ret->partial_event.add([self, copy](auto&, auto& res, auto& err) { self->on_partial(copy, res, err); });
+    ret->response_event.add([self, copy](auto&, auto& res, auto& err) { self->on_response(copy, res, err); });
+    ret->redirect_event.add([self, copy](auto&, auto& res, auto& ctx) { self->on_redirect(copy, res, ctx); });
+    ret->continue_event.add([self, copy](auto&) {
+        if (self->_winner == copy) self->_request->continue_event(self->_request);
+    });
+    return ret;
+}
+
+ClientSP HedgedRequest::attempt (bool hedge) {
+    auto req = make_copy();
+    _attempts.push_back({req, hedge});
+    Tracer::Scope scope(_request->_span);
+    return _pool->request(req);
+}
+
+void HedgedRequest::on_timer () {
+    HedgedRequestSP hold = this;
+    if (_winner) return;
+    if (!_pool->take_hedge_token()) {
+        panda_log_debug("hedge budget is exhausted for " << _request->uri->to_string());
+        ++_pool->_hedge_stats.throttled;
+        return;
+    }
+    ++_hedges;
+    ++_pool->_hedge_stats.hedges;
+    panda_log_info("hedging request to " << _request->uri->to_string() << " (" << _hedges << " of " << _request->hedge.max_hedges << ")");
+    if (_hedges < _request->hedge.max_hedges) _timer->once(_delay);
+    attempt(true);
+}
+
+// the first copy to get any response wins, failed one only if nothing else is in flight
+bool HedgedRequest::win (Request* req, const ErrorCode& err) {
+    if (err && _attempts.size() > 1) return false;
+    _winner = req;
+    stop_timer();
+
+    Attempts losers;
+    for (auto& a : _attempts) {
+        if (a.request.get() != req) losers.push_back(a);
+        else if (a.hedge)           ++_pool->_hedge_stats.wins;
+    }
+    _attempts.erase(std::remove_if(_attempts.begin(), _attempts.end(), [req](auto& a) { return a.request.get() != req; }), _attempts.end());
+
+    for (auto& a : losers) a.request->cancel();
+    return true;
+}
+
+void HedgedRequest::on_partial (Request* req, const ResponseSP& res, const ErrorCode& err) {
+    if (!_winner && !win(req, err)) return;
+    if (req == _winner) _request->partial_event(_request, res, err);
+}
+
+void HedgedRequest::on_redirect (Request* req, const ResponseSP& res, const RedirectContextSP& ctx) {
+    if (!_winner) win(req, {});
+    if (req == _winner) _request->redirect_event(_request, res, ctx);
+}
+
+void HedgedRequest::on_response (Request* req, const ResponseSP& res, const ErrorCode& err) {
+    HedgedRequestSP hold = this;
+    if (req != _winner) { // lost or failed
+        _attempts.erase(std::remove_if(_attempts.begin(), _attempts.end(), [req](auto& a) { return a.request.get() == req; }), _attempts.end());
+        return;
+    }
+    _attempts.clear();
+    auto request = _request;
+    request->_hedged = nullptr;
+    request->finish_and_notify(res, err, false); // final partial_event has been forwarded
+}
+
+void HedgedRequest::cancel (const ErrorCode& err) {
+    HedgedRequestSP hold = this;
+    _winner = _request.get(); // none of the copies
+    stop_timer();
+    auto attempts = std::move(_attempts);
+    for (auto& a : attempts) a.request->cancel();
+    auto request = _request;
+    request->_hedged = nullptr;
+    request->finish_and_notify({}, err);
+}
+
+void HedgedRequest::stop_timer () {
+    if (!_timer) return;
+    _timer->stop();
+    // we might be inside of the timer's callback, so it dies on the next loop iteration
+    auto timer = std::move(_timer);
+    _pool->loop()->delay([timer]{});
+}
+
+}}}
@@ -0,0 +1,47 @@
+#pragma once
+#include "Pool.h"
+#include "Request.h"
+#include <vector>
+#include <panda/refcnt.h>
+#include <panda/unievent/Timer.h>
+
+namespace panda { namespace unievent { namespace http {
+
+// Tail latency protection for an idempotent request sent via Pool (see Request::hedge). The request itself is not sent, its copies are:
+// the first one at once, and another one every hedge delay while none of them is answered, within request's max_hedges and pool's
+// hedge budget. The copy which gets response first wins, its response goes to the request, the others are canceled (their connections
+// are closed). A failed copy loses unless it's the last one in flight. Request's timeout counts from the start, not for every copy.
+struct HedgedRequest : Refcnt {
+    HedgedRequest (Pool*, const RequestSP&, uint64_t delay);
+
+    ClientSP start  (); // returns client which the first copy is sent on (if any)
+    void     cancel (const ErrorCode&);
+
+    static bool hedgeable (const RequestSP&);
+
+private:
+    struct Attempt {
+        RequestSP request;
+        bool      hedge; // not the first copy
+    };
+    using Attempts = std::vector<Attempt>;
+
+    PoolSP     _pool; // pool must outlive the copies it runs
+    RequestSP  _request;
+    uint64_t   _delay;
+    TimerSP    _timer;
+    Attempts   _attempts; // in flight
+    uint32_t   _hedges = 0;
+    Request*   _winner = nullptr;
+
+    RequestSP make_copy   ();
+    ClientSP  attempt     (bool hedge);
+    void      on_timer    ();
+    void      on_partial  (Request*, const ResponseSP&, const ErrorCode&);
+    void      on_redirect (Request*, const ResponseSP&, const RedirectContextSP&);
+    void      on_response (Request*, const ResponseSP&, const ErrorCode&);
+    bool      win         (Request*, const ErrorCode&);
+    void      stop_timer  ();
+};
+
+}}}
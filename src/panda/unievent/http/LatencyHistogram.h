@@ -0,0 +1,70 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+namespace panda { namespace unievent { namespace http {
+
+// Log-linear buckets with 1/32 relative precision (like HdrHistogram with 2 significant digits), values in microseconds.
+// Buckets are allocated up to the largest value seen, so typical latencies take a few KB. Histograms are merged by adding counts.
+struct LatencyHistogram {
+    static constexpr const unsigned SUB = 32;
+
+    static size_t index (uint64_t v) {
+        if (v < SUB * 2) return v;
+        unsigned shift = 63 - __builtin_clzll(v) - 5;
+        return SUB * 2 + (shift - 1) * SUB + ((v >> shift) - SUB);
+    }
+
+    // highest value falling into bucket
+    static uint64_t value (size_t i) {
+        if (i < SUB * 2) return i;
+        unsigned shift = (i - SUB * 2) / SUB + 1;
+        uint64_t sub   = (i - SUB * 2) % SUB + SUB;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    void add (uint64_t v) {
+        auto i = index(v);
+        if (i >= _counts.size()) _counts.resize(i + 1);
+        ++_counts[i];
+        ++_count;
+        _sum += v;
+        if (v > _max) _max = v;
+    }
+
+    LatencyHistogram& operator+= (const LatencyHistogram& oth) {
+        if (_counts.size() < oth._counts.size()) _counts.resize(oth._counts.size());
+        for (size_t i = 0; i < oth._counts.size(); ++i) _counts[i] += oth._counts[i];
+        _count += oth._count;
+        _sum   += oth._sum;
+        _max    = std::max(_max, oth._max);
+        return *this;
+    }
+
+    uint64_t count () const { return _count; }
+    uint64_t sum   () const { return _sum; }
+    uint64_t max   () const { return _max; }
+    double   mean  () const { return _count ? double(_sum) / _count : 0; }
+
+    uint64_t percentile (double p) const {
+        if (!_count) return 0;
+        uint64_t target = std::max<uint64_t>(1, uint64_t(_count * p / 100 + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < _counts.size(); ++i) {
+            seen += _counts[i];
+            if (seen >= target) return std::min(value(i), _max);
+        }
+        return _max;
+    }
+
+    const std::vector<uint64_t>& buckets () const { return _counts; }
+
+private:
+    std::vector<uint64_t> _counts;
+    uint64_t              _count = 0;
+    uint64_t              _sum   = 0;
+    uint64_t              _max   = 0;
+};
+
+}}}
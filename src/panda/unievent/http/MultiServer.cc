@@ -0,0 +1,192 @@
+#include "MultiServer.h"
+#include <algorithm>
+
+namespace panda { namespace unievent { namespace http {
+
+// panda::string copies share buffers with non-atomic refcounter, so every worker must own its buffers
+static Server::Config isolate (const Server::Config& src) {
+    Server::Config ret = src;
+    for (auto& loc : ret.locations) {
+        loc.host = string(loc.host.data(), loc.host.length());
+        loc.path = string(loc.path.data(), loc.path.length());
+    }
+    ret.metrics_path = string(src.metrics_path.data(), src.metrics_path.length());
+    return ret;
+}
+
+MultiServer::MultiServer (const Config& conf, const LoopSP& loop) : _loop(loop), _conf(conf), _ndone(0) {
+    if (!_conf.locations.size()) throw HttpError("no locations to listen supplied");
+    if (!_conf.workers) _conf.workers = std::max(1u, std::thread::hardware_concurrency());
+
+    if (_conf.workers > 1) {
+        #ifdef _WIN32
+        throw HttpError("several workers require SO_REUSEPORT which is not supported on windows");
+        #endif
+        for (auto& loc : _conf.locations) {
+            if (loc.path || loc.sock) throw HttpError("unix sockets, named pipes and custom sockets can not be shared between workers");
+            loc.reuse_port = true;
+        }
+    }
+
+    _done = new Async([this](auto&){ on_done(); }, _loop);
+    _done->weak(true);
+}
+
+MultiServer::~MultiServer () {
+    send(Command::stop);
+    join();
+}
+
+void MultiServer::run () {
+    if (_state != State::initial) throw HttpError("server is already running");
+    panda_log_notice("starting HTTP server with " << _conf.workers << " workers");
+    _ndone = 0;
+    {
+        std::lock_guard<std::mutex> lock(_metrics_mutex);
+        _metrics.clear();
+    }
+
+    auto conf = _conf; // ports of the first worker are applied to the rest, as location might have port 0
+    try {
+        for (uint32_t i = 0; i < _conf.workers; ++i) {
+            std::unique_ptr<Worker> w(new Worker());
+            w->conf = isolate(conf);
+
+            std::promise<std::vector<net::SockAddr>> started;
+            auto future = started.get_future();
+            w->thread = std::thread(&MultiServer::worker_main, this, w.get(), &started);
+            _workers.push_back(std::move(w));
+
+            auto addrs = future.get(); // rethrows worker's initialization error
+            if (i) continue;
+
+            if (addrs.size()) _sockaddr = addrs.front();
+            for (size_t j = 0; j < addrs.size() && j < conf.locations.size(); ++j) {
+                if (!conf.locations[j].path && !conf.locations[j].sock) conf.locations[j].port = addrs[j].port();
+            }
+        }
+    }
+    catch (...) {
+        send(Command::stop);
+        join();
+        throw;
+    }
+
+    _state = State::running;
+    _done->weak(false);
+}
+
+void MultiServer::stop () {
+    if (_state == State::initial) return;
+    _state = State::stopping;
+    send(Command::stop);
+}
+
+void MultiServer::graceful_stop () {
+    if (_state != State::running) return;
+    _state = State::stopping;
+    send(Command::graceful_stop);
+}
+
+ServerMetrics::Snapshot MultiServer::metrics () const {
+    ServerMetrics::Snapshot ret;
+    std::lock_guard<std::mutex> lock(_metrics_mutex);
+    for (auto& m : _metrics) ret += m->snapshot();
+    return ret;
+}
+
+excepted<net::SockAddr, ErrorCode> MultiServer::sockaddr () const {
+    if (_state == State::initial) return make_unexpected(make_error_code(std::errc::not_connected));
+    return _sockaddr;
+}
+
+void MultiServer::worker_main (Worker* w, std::promise<std::vector<net::SockAddr>>* started) {
+    bool ready = false;
+    try {
+        LoopSP   loop   = new Loop();
+        ServerSP server = new Server(loop);
+        {
+            std::lock_guard<std::mutex> lock(_metrics_mutex);
+            _metrics.push_back(server->shared_metrics());
+        }
+        server->metrics_source([this]{ return metrics(); });
+
+        for (auto& cb : route_event._list)   server->route_event.add([cb](const ServerRequestSP& req) { cb(req); });
+        for (auto& cb : request_event._list) server->request_event.add([cb](const ServerRequestSP& req) { cb(req); });
+        for (auto& cb : error_event._list)   server->error_event.add([cb](const ServerRequestSP& req, const ErrorCode& err) { cb(req, err); });
+        for (auto& cb : connect_event._list) server->connect_event.add([cb](const ServerConnectionSP& conn) { cb(conn); });
+        for (auto& cb : init_event._list)    cb(server);
+
+        server->configure(w->conf);
+
+        auto lp = loop.get();
+        server->stop_event.add([lp]{ lp->stop(); });
+
+        AsyncSP control = new Async([w, server](auto&) {
+            switch (w->command.load()) {
+                case Command::stop          : server->stop(); break;
+                case Command::graceful_stop : server->graceful_stop(); break;
+                case Command::none          : break;
+            }
+        }, loop);
+
+        server->run();
+
+        std::vector<net::SockAddr> addrs;
+        for (auto& lst : server->listeners()) {
+            auto sa = lst->sockaddr();
+            addrs.push_back(sa ? sa.value() : net::SockAddr());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(w->mutex);
+            w->control = control.get();
+        }
+        ready = true;
+        started->set_value(std::move(addrs));
+
+        if (w->command.load() != Command::none) control->send(); // command might have been sent before control was published
+
+        loop->run();
+
+        std::lock_guard<std::mutex> lock(w->mutex);
+        w->control = nullptr;
+    }
+    catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(w->mutex);
+            w->control = nullptr;
+        }
+        if (!ready) {
+            started->set_exception(std::current_exception());
+            return;
+        }
+        panda_log_error("worker thread terminated by exception");
+    }
+
+    ++_ndone;
+    _done->send();
+}
+
+void MultiServer::send (Command cmd) {
+    for (auto& w : _workers) {
+        std::lock_guard<std::mutex> lock(w->mutex);
+        w->command = cmd;
+        if (w->control) w->control->send();
+    }
+}
+
+void MultiServer::on_done () {
+    if (_state == State::initial || _ndone.load() < _workers.size()) return;
+    join();
+    _state = State::initial;
+    _done->weak(true);
+    stop_event();
+}
+
+void MultiServer::join () {
+    for (auto& w : _workers) if (w->thread.joinable()) w->thread.join();
+    _workers.clear();
+}
+
+}}}
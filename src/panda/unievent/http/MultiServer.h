@@ -0,0 +1,112 @@
+#pragma once
+#include "Server.h"
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <panda/unievent/Async.h>
+
+namespace panda { namespace unievent { namespace http {
+
+// Runs N servers with the same config, each in its own thread with its own Loop, all listening the same locations via SO_REUSEPORT.
+// Kernel balances incoming connections between workers.
+struct MultiServer : Refcnt {
+    struct Config : Server::Config {
+        uint32_t workers = 0; // number of worker threads, 0 = number of cpu cores
+
+        Config () {}
+        Config (const Server::Config& conf, uint32_t workers = 0) : Server::Config(conf), workers(workers) {}
+    };
+
+    // Callbacks are copied into every worker when server starts and are called from worker's thread.
+    // Therefore they must be thread-safe and must not share any non-thread-safe objects (like refcounted pointers) between workers.
+    template <class F>
+    struct Forward {
+        using callback_t = std::function<F>;
+
+        void add        (const callback_t& cb) { _list.push_back(cb); }
+        void remove_all ()                     { _list.clear(); }
+
+        bool has_listeners () const { return !_list.empty(); }
+
+    private:
+        friend MultiServer;
+        std::vector<callback_t> _list;
+    };
+
+    using init_fptr = void(const ServerSP&);
+    using stop_fptr = void();
+    using stop_fn   = function<stop_fptr>;
+
+    Forward<init_fptr>            init_event;    // called in worker's thread after worker's server is created and before it's run
+    Forward<Server::route_fptr>   route_event;
+    Forward<Server::request_fptr> request_event;
+    Forward<Server::error_fptr>   error_event;
+    Forward<Server::connect_fptr> connect_event;
+
+    CallbackDispatcher<stop_fptr> stop_event; // called in owner's loop after all workers have stopped
+
+    MultiServer (const Config&, const LoopSP& loop = Loop::default_loop());
+
+    const LoopSP& loop    () const { return _loop; }
+    uint32_t      workers () const { return _conf.workers; }
+
+    bool running  () const { return _state == State::running; }
+    bool stopping () const { return _state == State::stopping; }
+
+    // starts worker threads and waits until all of them begin listening. Exceptions from workers' initialization are rethrown here.
+    void run ();
+
+    // both are async: stop_event is called in owner's loop when all workers are done
+    void stop          ();
+    void graceful_stop ();
+
+    // address of the first location as it was bound (useful if port was 0)
+    excepted<net::SockAddr, ErrorCode> sockaddr () const;
+
+    // sum of all workers' metrics since last run(), may be called from any thread. It's also what workers export via Config::metrics_path.
+    ServerMetrics::Snapshot metrics () const;
+
+protected:
+    ~MultiServer (); // restrict stack allocation, stops and joins workers if still running
+
+private:
+    enum class State   { initial, running, stopping };
+    enum class Command { none, stop, graceful_stop };
+
+    struct Worker {
+        Server::Config       conf;              // private deep copy, touched only by worker's thread while it runs
+        std::thread          thread;
+        std::mutex           mutex;
+        Async*               control = nullptr; // belongs to worker's loop, guarded by mutex, null when worker's loop is not running
+        std::atomic<Command> command;
+
+        Worker () : command(Command::none) {}
+    };
+    using Workers = std::vector<std::unique_ptr<Worker>>;
+
+    LoopSP                _loop;
+    Config                _conf;
+    State                 _state = State::initial;
+    Workers               _workers;
+    AsyncSP               _done;
+    std::atomic<uint32_t> _ndone;
+    net::SockAddr         _sockaddr;
+
+    mutable std::mutex                                _metrics_mutex;
+    std::vector<std::shared_ptr<const ServerMetrics>> _metrics; // of every worker started
+
+    void worker_main (Worker*, std::promise<std::vector<net::SockAddr>>*);
+    void send        (Command);
+    void on_done     ();
+    void join        ();
+
+    MultiServer (const MultiServer&) = delete;
+    MultiServer& operator= (const MultiServer&) = delete;
+};
+using MultiServerSP = iptr<MultiServer>;
+
+}}}
@@ -1,7 +1,9 @@
 #include "Pool.h"
+#include "HedgedRequest.h"
 #include "panda/error.h"
 #include "panda/unievent/http/Request.h"
 #include "panda/unievent/http/error.h"
+#include <algorithm>
 
 namespace panda { namespace unievent { namespace http {
 
@@ -11,15 +13,28 @@ static thread_local struct {
 
 thread_local std::vector<PoolSP>* Pool::_instances = &tls.s_instances;
 
-Pool::Pool (Config cfg, const LoopSP& loop) : _loop(loop), _max_connections(cfg.max_connections), _factory(cfg.factory)  {
+Pool::Pool (Config cfg, const LoopSP& loop) : _loop(loop), _max_connections(cfg.max_connections), _pipeline_depth(cfg.pipeline_depth),
+    _max_total_connections(cfg.max_total_connections), _min_idle(cfg.min_idle), _factory(cfg.factory),
+    _tls_sessions(cfg.tls_sessions), _dns(loop, cfg.dns), _hedge_budget(cfg.hedge_budget),
+    _collect_timings(cfg.timings)
+{
     idle_timeout(cfg.idle_timeout);
 }
 
 Pool::~Pool () {
     // there might be some clients still active, remove event listener as we no longer care about of those clients
     for (auto& list : _clients) {
-        for (auto& client : list.second.busy) client->_pool = nullptr;
-        for (auto& queued_req : list.second.queue) queued_req->finish_and_notify({}, make_error_code(std::errc::operation_canceled));
+        for (auto& client : list.second.busy) {
+            client->_pool = nullptr;
+            // requests in flight outlive us, they must not record their timings here when finished
+            if (client->_request) client->_request->_pool = nullptr;
+            for (auto& p : client->_pipeline) p.request->_pool = nullptr;
+        }
+        for (auto& client : list.second.free) client->_pool = nullptr; // user might still hold it
+        for (auto& queued_req : list.second.queue) {
+            queued_req->_queued = false;
+            queued_req->finish_and_notify({}, make_error_code(std::errc::operation_canceled));
+        }
     }
 }
 
@@ -37,37 +52,53 @@ void Pool::idle_timeout (uint32_t val) {
         _idle_timer->event.add([this](auto&){ this->check_inactivity(); });
     }
 
-    _idle_timer->start(val >= 1000 ? 1000 : val);
+    arm_idle_timer();
+}
+
+// free clients expire in order of their last activity, so the timer is only needed for the first one
+void Pool::arm_idle_timer () {
+    if (!_idle_timer || _idle.empty() || _idle_timer->active()) return;
+    auto expires = _idle.front()->last_activity_time() + _idle_timeout;
+    auto now     = _loop->now();
+    _idle_timer->once(expires > now ? expires - now : 1);
 }
 
 ClientSP Pool::request (const RequestSP& req) {
     req->check();
+    if (req->_hedged) throw HttpError("request is already in progress");
+    if (req->timings.start(std::chrono::steady_clock::now())) req->trace_start();
+    if (_hedge_budget && HedgedRequest::hedgeable(req)) {
+        if (auto delay = hedge_delay(req)) return hedge(req, delay);
+    }
+
     req->_pool = this;
     ClientSP client;
 
-    auto netloc = req->netloc();
-    auto it = _clients.find(netloc);
+    auto& list = _clients[req->netloc()];
 
-    // no clients to host, create a busy one
-    if (it == _clients.end()) {
-        client = new_client();
-        _clients.emplace(netloc, NetLocList{{}, {client}, {}});
-    }
-    // reuse client from free to busy
-    else if (!it->second.free.empty()) {
-        auto free_pos = it->second.free.begin();
-        client = *free_pos;
-        it->second.free.erase(free_pos);
-        it->second.busy.insert(client);
+    // reuse the most recently used client from free to busy
+    if (!list.free.empty()) {
+        client = list.free.front();
+        _idle.erase(client->_idle_pos);
+        client->_free = false;
+        list.busy.splice(list.busy.end(), list.free, list.free.begin());
     }
-    // all clients are busy -> create new client, if limit is not hit
-    else if (it->second.busy.size() < _max_connections) {
+    // all clients are busy -> create new client, if limits are not hit
+    else if (list.busy.size() < _max_connections && reserve_slot()) {
         client = new_client();
-        it->second.busy.insert(client);
+        client->_pool_pos = list.busy.insert(list.busy.end(), client);
+        ++_nclients;
+    }
+    // connection limit is hit -> pipeline the request to the least loaded connection, if allowed
+    else if (auto pclient = pipelining_client(list, req)) {
+        pclient->pipeline(req);
+        return pclient;
     }
     // just enqueue the request
     else {
-        it->second.queue.emplace_back(req);
+        req->_queue_pos = list.queue.insert(list.queue.end(), req);
+        req->_queued    = true;
+        wait_for_slot(list);
         if (req->timeout) req->ensure_timer_active(loop());
     }
 
@@ -76,58 +107,282 @@ ClientSP Pool::request (const RequestSP& req) {
     return client;
 }
 
+ClientSP Pool::pipelining_client (const NetLocList& list, const RequestSP& req) const {
+    if (!_pipeline_depth || !Client::pipelinable(req)) return {};
+    ClientSP ret;
+    for (auto& client : list.busy) {
+        if (client->_pipeline.size() >= _pipeline_depth || !client->can_pipeline()) continue;
+        if (!ret || client->_pipeline.size() < ret->_pipeline.size()) ret = client;
+    }
+    return ret;
+}
+
+// explicit delay, or percentile of the host's response times when enough of them are observed
+uint64_t Pool::hedge_delay (const RequestSP& req) const {
+    auto& policy = req->hedge;
+    if (!policy.percentile) return policy.delay;
+    auto it = _latencies.find(req->netloc());
+    if (it == _latencies.end() || it->second.samples.size() < LATENCY_MIN_SAMPLES) return policy.delay;
+    auto samples = it->second.samples;
+    auto n = std::min(samples.size() - 1, size_t(samples.size() * policy.percentile / 100));
+    std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+    return std::max<uint64_t>(samples[n], 1);
+}
+
+ClientSP Pool::hedge (const RequestSP& req, uint64_t delay) {
+    if (!req->uri->scheme()) req->uri->scheme("http");
+    ++_hedge_stats.requests;
+    _hedge_tokens += _hedge_budget / 100.0;
+    if (_hedge_tokens > HEDGE_BURST) _hedge_tokens = HEDGE_BURST;
+    req->_pool   = this;
+    req->_hedged = new HedgedRequest(this, req, delay);
+    if (req->timeout) req->ensure_timer_active(loop());
+    return req->_hedged->start();
+}
+
+bool Pool::take_hedge_token () {
+    if (_hedge_tokens < 1) return false;
+    _hedge_tokens -= 1;
+    return true;
+}
+
+// from the time request was given to pool, with all its retries, redirects and duplicates
+void Pool::record_latency (const NetLoc& netloc, const RequestTimings& t) {
+    if (!_hedge_budget) return;
+    auto value = std::chrono::duration_cast<std::chrono::milliseconds>(t.done - t.queued).count();
+    auto& l = _latencies[netloc];
+    if (l.samples.size() < LATENCY_SAMPLES) l.samples.push_back(value);
+    else                                    l.samples[l.next] = value;
+    l.next = (l.next + 1) % LATENCY_SAMPLES;
+}
+
+static inline uint64_t elapsed (RequestTimings::time_point from, RequestTimings::time_point to) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+}
+
+void Pool::record_timings (const NetLoc& netloc, const RequestTimings& t) {
+    if (!_collect_timings) return;
+    using time_point = RequestTimings::time_point;
+    auto& h = _timings[netloc];
+    h.queue.add(elapsed(t.queued, t.dequeued));
+    auto established = t.dequeued;
+    if (t.dns != time_point()) {
+        h.dns.add(elapsed(t.dequeued, t.dns));
+        established = t.dns;
+    }
+    if (t.connected != time_point()) {
+        h.connect.add(elapsed(established, t.connected));
+        established = t.connected;
+    }
+    if (t.tls != time_point()) {
+        h.tls.add(elapsed(t.connected, t.tls));
+        established = t.tls;
+    }
+    auto sent = t.first_byte;
+    if (t.written != time_point()) {
+        h.send.add(elapsed(established, t.written));
+        sent = t.written;
+    }
+    if (t.first_byte != time_point()) {
+        h.wait.add(elapsed(sent, t.first_byte));
+        h.receive.add(elapsed(t.first_byte, t.done));
+    }
+    h.total.add(elapsed(t.queued, t.done));
+}
+
+const Pool::Timings* Pool::timings (const NetLoc& netloc) const {
+    auto it = _timings.find(netloc);
+    return it == _timings.end() ? nullptr : &it->second;
+}
+
+Pool::Timings Pool::timings () const {
+    Timings ret;
+    for (auto& row : _timings) ret += row.second;
+    return ret;
+}
+
+Pool::Timings& Pool::Timings::operator+= (const Timings& oth) {
+    queue   += oth.queue;
+    dns     += oth.dns;
+    connect += oth.connect;
+    tls     += oth.tls;
+    send    += oth.send;
+    wait    += oth.wait;
+    receive += oth.receive;
+    total   += oth.total;
+    return *this;
+}
+
 void Pool::cancel_request(const RequestSP& req, const ErrorCode& err) {
-    auto netloc = req->netloc();
-    auto it = _clients.find(netloc);
+    assert(req->_queued);
+    auto it = _clients.find(req->netloc());
     assert(it != _clients.end());
-    auto& q = it->second.queue;
-    bool found = false;
-    // TODO: O(1) search (for example via additional set<Request*> index)
-    for (auto it = q.cbegin(); it != q.cend(); ++it) {
-        if (*it != req) continue;
-        (*it)->finish_and_notify({}, err);
-        q.erase(it);
-        found = true;
-        break;
-    }
-    assert(found);
+    it->second.queue.erase(req->_queue_pos);
+    req->_queued = false;
+    req->finish_and_notify({}, err);
 }
 
 void Pool::putback (const ClientSP& client) {
     auto it = _clients.find(client->last_netloc());
     assert(it != _clients.end());
-    auto& queue = it->second.queue;
+    auto& list = it->second;
+
+    // max_total_connections is hit and hosts wait for a connection -> it goes to the next of them (round-robin), this host goes to
+    // the end of line if it has more queued requests
+    if (auto next = pop_waiting()) {
+        next->busy.splice(next->busy.end(), list.busy, client->_pool_pos);
+        wait_for_slot(list);
+        if (list.free.empty() && list.busy.empty() && list.queue.empty() && !list.waiting && !list.warm) _clients.erase(it);
+        start_queued(*next, client);
+        return;
+    }
+
+    auto& queue = list.queue;
     // process the next requests (if any) on the same client
     if (queue.size()) {
         auto req = queue.front();
         queue.pop_front();
+        req->_queued = false;
         client->request(req);
     }
     // mark connection as free
-    else {
-        auto busy_pos = it->second.busy.find(client);
-        assert(busy_pos != it->second.busy.end());
+    else make_free(list, client);
+}
+
+void Pool::make_free (NetLocList& list, const ClientSP& client) {
+    list.free.splice(list.free.begin(), list.busy, client->_pool_pos);
+    client->_idle_pos = _idle.insert(_idle.end(), client.get());
+    client->_free     = true;
+    arm_idle_timer();
+}
+
+void Pool::close_idle (Client* client) {
+    auto it = _clients.find(client->last_netloc());
+    assert(it != _clients.end());
+    auto& list = it->second;
+    _idle.erase(client->_idle_pos);
+    client->_free = false;
+    list.free.erase(client->_pool_pos);
+    --_nclients;
+    if (list.free.empty() && list.busy.empty() && list.queue.empty() && !list.waiting && !list.warm) _clients.erase(it);
+}
+
+void Pool::drop_idle (Client* client, bool refill_host) {
+    auto& list = _clients.find(client->last_netloc())->second;
+    bool warm = refill_host && list.warm; // prewarmed hosts are never removed, so list stays valid
+    close_idle(client);
+    grant_slots();
+    // failed prewarmed connection is not retried right away, so that unreachable host is not hammered
+    if (warm) refill(list, _min_idle);
+}
+
+void Pool::min_idle (uint32_t value) {
+    _min_idle = value;
+    refill_all();
+}
+
+void Pool::prewarm (const RequestSP& req, uint32_t n) {
+    req->check();
+    if (!req->uri->scheme()) req->uri->scheme("http");
+    auto& list = _clients[req->netloc()];
+    if (!list.warm) _warm.push_back(&list);
+    list.warm = req;
+    refill(list, std::max(n, _min_idle));
+}
+
+// opens idle connections to prewarmed host up to n, as long as connection limits allow
+void Pool::refill (NetLocList& list, size_t n) {
+    while (list.free.size() < n && list.free.size() + list.busy.size() < _max_connections &&
+           (!_max_total_connections || _nclients < _max_total_connections))
+    {
+        ClientSP client = new_client();
+        client->_pool_pos           = list.free.insert(list.free.end(), client); // used ones go first, they are surely established
+        client->_idle_pos           = _idle.insert(_idle.end(), client.get());
+        client->_free               = true;
+        client->_last_activity_time = _loop->now();
+        ++_nclients;
+        client->establish(list.warm, list.warm->netloc());
+        client->weak(true);
+    }
+    arm_idle_timer();
+}
+
+void Pool::refill_all () {
+    for (auto list : _warm) refill(*list, _min_idle);
+}
+
+void Pool::max_total_connections (uint32_t value) {
+    _max_total_connections = value;
+    grant_slots();
+}
 
-        it->second.busy.erase(busy_pos);
-        it->second.free.insert(client);
+// makes room for a new connection, closing the oldest idle one if max_total_connections is hit
+bool Pool::reserve_slot () {
+    if (!_max_total_connections || _nclients < _max_total_connections) return true;
+
+    if (_idle.empty()) return false;
+
+    panda_log_debug("closing idle connection to " << _idle.front()->last_netloc().host << " to fit max_total_connections");
+    close_idle(_idle.front());
+    return true;
+}
+
+// starts connections for waiting hosts while max_total_connections allows
+void Pool::grant_slots () {
+    while (!_max_total_connections || _nclients < _max_total_connections) {
+        auto list = pop_waiting();
+        if (!list) break;
+        ClientSP client = new_client();
+        client->_pool_pos = list->busy.insert(list->busy.end(), client);
+        ++_nclients;
+        start_queued(*list, client);
     }
 }
 
+void Pool::wait_for_slot (NetLocList& list) {
+    if (list.waiting || list.queue.empty() || list.busy.size() >= _max_connections) return;
+    list.waiting = true;
+    _waiting.push_back(&list);
+}
+
+// returns the first waiting host which still needs a connection (its requests might have been canceled meanwhile)
+Pool::NetLocList* Pool::pop_waiting () {
+    while (_waiting.size()) {
+        auto list = _waiting.front();
+        _waiting.pop_front();
+        list->waiting = false;
+        if (list->queue.size() && list->busy.size() < _max_connections) return list;
+    }
+    return nullptr;
+}
+
+// runs the first queued request of the host on the client from its busy list (possibly connected to another host)
+void Pool::start_queued (NetLocList& list, const ClientSP& client) {
+    auto req = list.queue.front();
+    list.queue.pop_front();
+    req->_queued = false;
+    wait_for_slot(list);
+    client->request(req);
+}
+
 void Pool::check_inactivity () {
     panda_log_debug("check_inactivity now = " << _loop->now() << " tmt = " << _idle_timeout);
-    auto remove_time = _loop->now() - _idle_timeout;
-    for (auto it = _clients.begin(); it != _clients.end();) {
-        auto& list = it->second.free;
-        for (auto it = list.begin(); it != list.end();) {
-            if ((*it)->last_activity_time() < remove_time) {
-                panda_log_debug("removing inactive connection last activity = " << (*it)->last_activity_time());
-                it = list.erase(it);
-            }
-            else ++it;
+    auto now = _loop->now();
+    while (_idle.size() && _idle.front()->last_activity_time() + _idle_timeout <= now) {
+        auto client = _idle.front();
+        auto& list  = _clients.find(client->last_netloc())->second;
+        // min_idle connections of prewarmed host are kept instead of being closed and opened again, they start a new idle period
+        if (list.warm && list.free.size() <= _min_idle) {
+            client->_last_activity_time = now;
+            _idle.splice(_idle.end(), _idle, client->_idle_pos);
+            continue;
         }
-        if (list.empty() && it->second.busy.empty()) it = _clients.erase(it);
-        else ++it;
+        panda_log_debug("removing inactive connection last activity = " << client->last_activity_time());
+        close_idle(client);
     }
+    arm_idle_timer();
+    grant_slots();
+    refill_all();
 }
 
 size_t Pool::size () const {
@@ -145,4 +400,15 @@ size_t Pool::nbusy () const {
     return ret;
 }
 
+size_t Pool::nqueued () const {
+    size_t ret = 0;
+    for (auto& row : _clients) ret += row.second.queue.size();
+    return ret;
+}
+
+size_t Pool::nqueued (const NetLoc& netloc) const {
+    auto it = _clients.find(netloc);
+    return it == _clients.end() ? 0 : it->second.queue.size();
+}
+
 }}}
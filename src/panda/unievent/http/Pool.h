@@ -1,10 +1,14 @@
 #pragma once
 #include "Client.h"
+#include "DnsCache.h"
+#include "TlsSessionCache.h"
+#include "LatencyHistogram.h"
 #include "panda/error.h"
 #include "panda/unievent/http/Request.h"
-#include <set>
-#include <unordered_map>
 #include <deque>
+#include <unordered_map>
+#include <list>
+#include <vector>
 
 namespace panda { namespace unievent { namespace http {
 
@@ -14,12 +18,23 @@ using PoolSP = iptr<Pool>;
 struct Pool : Refcnt {
     static constexpr const uint32_t DEFAULT_IDLE_TIMEOUT = 60000; // [ms]
     static constexpr const uint32_t DEFAULT_MAX_CONNECTIONS = 10; // max active connections per host:port
+    static constexpr const uint32_t DEFAULT_HEDGE_BUDGET    = 10; // [%]
 
     struct IFactory { virtual ClientSP new_client (Pool*) = 0; };
 
     struct Config {
         uint32_t  max_connections = DEFAULT_MAX_CONNECTIONS;
         uint32_t  idle_timeout    = DEFAULT_IDLE_TIMEOUT;
+        uint32_t  pipeline_depth  = 0; // when max_connections is hit, idempotent requests are sent to busy connections ahead of responses,
+                                       // up to that many per connection, instead of waiting in queue. 0 = no pipelining
+        uint32_t  max_total_connections = 0; // max connections to all hosts together, 0 = unlimited. When hit, the oldest idle connection
+                                             // to another host is closed, otherwise requests wait and hosts get connections round-robin
+        uint32_t  min_idle        = 0; // idle connections kept established to every upstream registered with prewarm()
+        size_t    tls_sessions    = TlsSessionCache::DEFAULT_MAX_COUNT; // TLS sessions kept for resumption on reconnect, 0 = disabled
+        DnsCache::Config dns;          // addresses of hosts are resolved through pool's cache, see DnsCache
+        uint32_t  hedge_budget    = DEFAULT_HEDGE_BUDGET; // [%] duplicates sent by hedging (see Request::hedge) may add at most that
+                                                          // share to hedged requests, 0 = hedging is off
+        bool      timings         = true; // collect latency breakdown of answered requests per host, see timings()
         IFactory* factory         = nullptr;
         Config () {}
     };
@@ -45,21 +60,80 @@ struct Pool : Refcnt {
     uint32_t max_connections () const { return _max_connections; }
     void     max_connections (uint32_t value) { _max_connections = value; }
 
+    uint32_t pipeline_depth () const { return _pipeline_depth; }
+    void     pipeline_depth (uint32_t value) { _pipeline_depth = value; }
+
+    uint32_t max_total_connections () const { return _max_total_connections; }
+    void     max_total_connections (uint32_t);
+
+    uint32_t min_idle () const { return _min_idle; }
+    void     min_idle (uint32_t);
+
+    // establishes connections (including TLS handshake) to the upstream described by req (uri, ssl, proxy, timeouts; req itself is
+    // not sent), so that there are at least max(n, min_idle) idle ones. From now on the pool keeps min_idle idle connections to it:
+    // they are exempt from idle timeout and refilled when server closes them.
+    void prewarm (const RequestSP& req, uint32_t n = 0);
+
+    TlsSessionCache&       tls_sessions ()       { return _tls_sessions; }
+    const TlsSessionCache& tls_sessions () const { return _tls_sessions; }
+
+    DnsCache&       dns ()       { return _dns; }
+    const DnsCache& dns () const { return _dns; }
+
+    struct HedgeStats {
+        uint64_t requests  = 0; // sent with hedging
+        uint64_t hedges    = 0; // duplicates sent
+        uint64_t wins      = 0; // duplicates answered first
+        uint64_t throttled = 0; // duplicates not sent because of the budget
+    };
+
+    uint32_t hedge_budget () const { return _hedge_budget; }
+    void     hedge_budget (uint32_t value) { _hedge_budget = value; }
+
+    const HedgeStats& hedge_stats () const { return _hedge_stats; }
+
+    // Latency breakdown of successfully answered requests [us], from their RequestTimings. Phases which didn't happen are not recorded,
+    // e.g. dns, connect and tls for requests sent on reused connections.
+    struct Timings {
+        LatencyHistogram queue;   // queued -> dequeued, waiting for a connection
+        LatencyHistogram dns;     // dequeued -> dns
+        LatencyHistogram connect; // dns or dequeued -> TCP connected
+        LatencyHistogram tls;     // connected -> TLS handshake done
+        LatencyHistogram send;    // dequeued or connection established -> request written
+        LatencyHistogram wait;    // written -> first byte of response: server's time plus round trip
+        LatencyHistogram receive; // first byte -> done
+        LatencyHistogram total;   // queued -> done, including retries and redirects
+
+        Timings& operator+= (const Timings&);
+    };
+
+    const Timings* timings (const NetLoc&) const; // nullptr if no request to the host:port was answered yet
+    Timings        timings () const;              // of all hosts together
+    void           reset_timings () { _timings.clear(); }
+
     size_t size  () const;
     size_t nbusy () const;
 
+    size_t nqueued () const;                // requests waiting for a connection
+    size_t nqueued (const NetLoc&) const;   // requests waiting for a connection to the host:port
+
     bool empty () const { return _clients.size() == 0; }
 
 protected:
     virtual ClientSP new_client () { return _factory ? _factory->new_client(this) : ClientSP(new Client(this)); }
 
 private:
-    friend Client; friend Request;
+    friend Client; friend Request; friend HedgedRequest;
+
+    using ClientList = std::list<ClientSP>; // client knows its position, moves between lists are O(1) splices
+    using IdleList   = std::list<Client*>;  // free clients of all hosts, least recently used first
 
     struct NetLocList {
-        std::set<ClientSP> free;
-        std::set<ClientSP> busy;
-        std::deque<RequestSP> queue;
+        ClientList free; // most recently used first, so that warm connections are reused and cold ones time out
+        ClientList busy;
+        std::list<RequestSP> queue; // queued request knows its position, so that it is removed in O(1) on timeout or cancel
+        bool waiting = false;       // in _waiting
+        RequestSP warm;             // set if host is registered with prewarm(), describes how to connect
     };
 
     struct Hash {
@@ -77,6 +151,19 @@ private:
     };
 
     using Clients = std::unordered_map<NetLoc, NetLocList, Hash>;
+    using Waiting = std::deque<NetLocList*>; // elements of unordered_map are not moved on rehash
+    using Warm    = std::vector<NetLocList*>; // such hosts are never removed
+
+    struct Latencies {
+        std::vector<uint32_t> samples; // [ms] ring buffer of the last response times
+        size_t                next = 0;
+    };
+    using LatencyMap = std::unordered_map<NetLoc, Latencies, Hash>;
+    using TimingsMap = std::unordered_map<NetLoc, Timings, Hash>;
+
+    static constexpr const size_t LATENCY_SAMPLES     = 100;
+    static constexpr const size_t LATENCY_MIN_SAMPLES = 20;  // before percentile is trusted
+    static constexpr const double HEDGE_BURST         = 10;  // max budget tokens, i.e. duplicates sent in a row
 
     static thread_local std::vector<PoolSP>* _instances;
 
@@ -84,10 +171,45 @@ private:
     TimerSP   _idle_timer;
     uint32_t  _idle_timeout;
     uint32_t  _max_connections;
+    uint32_t  _pipeline_depth;
+    uint32_t  _max_total_connections;
+    uint32_t  _min_idle;
+    size_t    _nclients = 0;
     Clients   _clients;
+    Waiting   _waiting; // hosts with queued requests which wait for max_total_connections, not for their own max_connections
+    IdleList  _idle;
+    Warm      _warm;
+    TlsSessionCache _tls_sessions;
+    DnsCache        _dns;
+    uint32_t   _hedge_budget;
+    double     _hedge_tokens = 0;
+    HedgeStats _hedge_stats;
+    LatencyMap _latencies; // of every host while hedging is on, see hedge_delay()
+    bool       _collect_timings;
+    TimingsMap _timings;
     IFactory* _factory;
 
     void check_inactivity ();
+    void arm_idle_timer   ();
+    void make_free        (NetLocList&, const ClientSP&);
+    void close_idle       (Client*);
+    void drop_idle        (Client*, bool refill); // called from Client when idle connection is lost
+    void refill           (NetLocList&, size_t n);
+    void refill_all       ();
+
+    bool        reserve_slot  ();
+    void        grant_slots   ();
+    void        wait_for_slot (NetLocList&);
+    NetLocList* pop_waiting   ();
+    void        start_queued  (NetLocList&, const ClientSP&);
+
+    ClientSP pipelining_client (const NetLocList&, const RequestSP&) const;
+
+    uint64_t hedge_delay      (const RequestSP&) const;
+    ClientSP hedge            (const RequestSP&, uint64_t delay);
+    bool     take_hedge_token ();
+    void     record_latency   (const NetLoc&, const RequestTimings&);
+    void     record_timings   (const NetLoc&, const RequestTimings&);
 
     void putback (const ClientSP&); // called from Client when it's done
     
@@ -3,16 +3,21 @@
 #include "error.h"
 #include "Response.h"
 #include "Form.h"
+#include "SslConfig.h"
+#include "Tracer.h"
 #include <panda/unievent/Tcp.h>
 #include <panda/unievent/Timer.h>
 #include <panda/unievent/AddrInfo.h>
 #include <panda/CallbackDispatcher.h>
+#include <list>
+#include <chrono>
 
 namespace panda { namespace unievent { namespace http {
 
 struct Client;          using ClientSP  = iptr<Client>;
 struct Request;         using RequestSP = iptr<Request>;
 struct RedirectContext; using RedirectContextSP = iptr<RedirectContext>;
+struct HedgedRequest;   using HedgedRequestSP = iptr<HedgedRequest>;
 struct Pool;
 
 using panda::unievent::AddrInfoHints;
@@ -34,6 +39,55 @@ struct NetLoc {
 };
 std::ostream& operator<< (std::ostream& os, const NetLoc& h);
 
+// Resending of a request whose connection is lost before any part of response is received. Most often it's a keep-alive connection
+// closed by server as idle while the request was on its way, such requests are resent at once on a new connection.
+struct RetryPolicy {
+    uint32_t max_attempts    = 2;     // including the first one, 1 = never retry
+    uint64_t backoff         = 0;     // [ms] before resending when a new connection was lost, doubled with every attempt
+    bool     new_connections = false; // retry also when a new connection is lost, not only a reused keep-alive one
+    bool     non_idempotent  = false; // retry also requests which are not idempotent (see Request::idempotent())
+};
+
+// Duplicates of an idempotent request sent via Pool when it's not answered in time, see HedgedRequest
+struct HedgePolicy {
+    uint64_t delay      = 0; // [ms] before a duplicate is sent, 0 = no hedging (unless percentile is set)
+    double   percentile = 0; // if set (e.g. 95), the delay is that percentile of the host's recent response times, `delay` is used
+                             // until enough of them are observed
+    uint32_t max_hedges = 1; // duplicates per request, sent every delay while it's not answered
+};
+
+// Moments of request's last attempt [steady clock], a phase which didn't happen (e.g. connection was reused) is left zero.
+// Pool aggregates them per host, see Pool::timings().
+struct RequestTimings {
+    using time_point = std::chrono::steady_clock::time_point;
+    time_point queued;     // given to Pool (or Client)
+    time_point dequeued;   // given to a connection
+    time_point dns;        // host resolved via pool's DnsCache
+    time_point connected;  // TCP connection established
+    time_point tls;        // TLS handshake done
+    time_point written;    // whole request written to socket
+    time_point first_byte; // of response
+    time_point done;       // response completely received or request failed
+
+    // a new record is started unless the request is being retried or redirected, then it keeps the time it was first queued.
+    // Returns true if the record is new.
+    bool start (time_point now) {
+        if (queued != time_point() && done == time_point()) return false;
+        *this  = RequestTimings();
+        queued = now;
+        return true;
+    }
+
+    bool dequeue (time_point now) {
+        bool ret = start(now);
+        auto q   = queued;
+        *this    = RequestTimings();
+        queued   = q;
+        dequeued = now;
+        return ret;
+    }
+};
+
 struct Request : protocol::http::Request, private ITimerListener {
     struct Builder;
     using response_fptr = void(const RequestSP&, const ResponseSP&, const ErrorCode&);
@@ -48,9 +102,11 @@ struct Request : protocol::http::Request, private ITimerListener {
 
     static constexpr const uint64_t DEFAULT_TIMEOUT           = 20000; // [ms]
     static constexpr const uint16_t DEFAULT_REDIRECTION_LIMIT = 20;    // [hops]
+    static constexpr const uint64_t DEFAULT_CONNECT_ATTEMPT_DELAY = 250; // [ms] as recommended by RFC 8305
 
     uint64_t                          timeout           = DEFAULT_TIMEOUT;
     uint64_t                          connect_timeout   = 0; // [in ms, 0 means equal to timeout]
+    uint64_t                          connect_attempt_delay = DEFAULT_CONNECT_ATTEMPT_DELAY; // [ms] see HappyEyeballs, 0 = off
     bool                              follow_redirect   = true;
     bool                              tcp_nodelay       = false;
     uint16_t                          redirection_limit = DEFAULT_REDIRECTION_LIMIT;
@@ -64,11 +120,17 @@ struct Request : protocol::http::Request, private ITimerListener {
     AddrInfoHints                     tcp_hints         = Tcp::defhints;
     Form                              form;
     bool                              ssl_check_cert    = default_ssl_verify;
+    HedgePolicy                       hedge;
+    RetryPolicy                       retry;
+    RequestTimings                    timings;
 
     Request () {}
 
     bool transfer_completed () const { return _transfer_completed; }
 
+    // by method (RFC 7231 4.2.2) or by Idempotency-Key header
+    bool idempotent () const;
+
     void send_chunk        (const string& chunk);
     void send_final_chunk  (const string& chunk = {});
 
@@ -78,13 +140,26 @@ protected:
     protocol::http::ResponseSP new_response () const override { return new Response(); }
 
 private:
-    friend Client; friend struct Pool;
+    friend Client; friend struct Pool; friend HedgedRequest;
+    using QueuePos = std::list<RequestSP>::iterator;
 
     uint16_t _redirection_counter = 0;
     bool     _transfer_completed  = false;
     ClientSP _client;         // holds client when active, set if request is active and maintained by client
     Pool*    _pool = nullptr; // this backref only needed for method cancel() to work when queued (no active client)
     TimerSP  _timer;
+    QueuePos _queue_pos;      // position in pool's queue, valid if _queued
+    bool     _queued = false;
+    HedgedRequestSP _hedged;  // set while duplicates of the request are being sent instead of it
+    bool            _hedge_copy = false; // a duplicate sent by HedgedRequest, its latency is not the host's one
+    uint32_t        _retries = 0;
+    TimerSP         _retry_timer;
+    function<void()> _retry;  // resends request after backoff, set while waiting
+    TraceSpanPtr    _span;    // from first queueing till response_event, with all retries and redirects
+    string          _user_traceparent; // traceparent header given by user, it is replaced by the span's one while request is active
+
+    void trace_start  ();
+    void trace_finish (const Response*, const ErrorCode&);
 
     NetLoc netloc () const {
         if (proxy && proxy->scheme() == "http") {
@@ -107,13 +182,19 @@ private:
 
     void on_timer(const TimerSP&) override;
 
+    bool retriable () const {
+        return retry.max_attempts > 1 && !chunked && !form.size() && (retry.non_idempotent || idempotent());
+    }
+
+    void schedule_retry (const LoopSP&, uint64_t delay, const function<void()>&);
+
     void cleanup_after_redirect() {
         _client = nullptr;
         _transfer_completed = false;
         if (_timer) _timer->event_listener(nullptr);
     }
 
-    void finish_and_notify(ResponseSP, const ErrorCode&);
+    void finish_and_notify(ResponseSP, const ErrorCode&, bool notify_partial = true);
 };
 
 struct Request::Builder : protocol::http::Request::BuilderImpl<Builder, RequestSP> {
@@ -144,6 +225,21 @@ struct Request::Builder : protocol::http::Request::BuilderImpl<Builder, RequestS
         return *this;
     }
 
+    Builder& connect_attempt_delay (uint64_t delay) {
+        _message->connect_attempt_delay = delay;
+        return *this;
+    }
+
+    Builder& retry (const RetryPolicy& policy) {
+        _message->retry = policy;
+        return *this;
+    }
+
+    Builder& hedge (const HedgePolicy& policy) {
+        _message->hedge = policy;
+        return *this;
+    }
+
     Builder& follow_redirect (bool val) {
         _message->follow_redirect = val;
         return *this;
@@ -164,6 +260,13 @@ struct Request::Builder : protocol::http::Request::BuilderImpl<Builder, RequestS
         return *this;
     }
 
+    // process-wide context for the config (see SslConfig), requests with equal configs share pool connections
+    Builder& ssl_config (const SslConfig& cfg) {
+        _message->ssl_ctx        = ssl_context(cfg);
+        _message->ssl_check_cert = cfg.verify;
+        return *this;
+    }
+
     Builder& proxy (const URISP& proxy) {
         _message->proxy = proxy;
         return *this;
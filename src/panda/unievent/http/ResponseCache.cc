@@ -0,0 +1,296 @@
+#include "ResponseCache.h"
+#include "Server.h"
+#include <ctime>
+#include <algorithm>
+#include <panda/protocol/http/Fields.h>
+
+namespace panda { namespace unievent { namespace http {
+
+using protocol::http::iequals;
+using Method = protocol::http::Request::Method;
+
+namespace {
+    struct CacheControl {
+        bool    no_store = false;
+        bool    no_cache = false;
+        bool    priv     = false;
+        int64_t max_age  = -1;
+        int64_t s_maxage = -1;
+    };
+}
+
+// calls cb for every non-empty trimmed element of comma-separated list
+template <class F>
+static void for_each_token (const string& list, F&& cb) {
+    size_t pos = 0;
+    while (pos < list.length()) {
+        auto end = list.find(',', pos);
+        if (end == string::npos) end = list.length();
+        auto b = pos, e = end;
+        while (b < e && (list[b] == ' ' || list[b] == '\t')) ++b;
+        while (e > b && (list[e-1] == ' ' || list[e-1] == '\t')) --e;
+        if (e > b) cb(list.substr(b, e - b));
+        pos = end + 1;
+    }
+}
+
+static int64_t parse_number (const string& s) {
+    if (!s) return -1;
+    int64_t ret = 0;
+    for (auto c : s) {
+        if (c < '0' || c > '9') return -1;
+        ret = ret * 10 + (c - '0');
+    }
+    return ret;
+}
+
+static CacheControl parse_cache_control (const string& val) {
+    CacheControl ret;
+    for_each_token(val, [&](const string& token) {
+        auto eq   = token.find('=');
+        auto name = token.substr(0, eq);
+        if      (iequals(name, "no-store")) ret.no_store = true;
+        else if (iequals(name, "no-cache")) ret.no_cache = true;
+        else if (iequals(name, "private"))  ret.priv     = true;
+        else if (eq != string::npos) {
+            if      (iequals(name, "max-age"))  ret.max_age  = parse_number(token.substr(eq + 1));
+            else if (iequals(name, "s-maxage")) ret.s_maxage = parse_number(token.substr(eq + 1));
+        }
+    });
+    return ret;
+}
+
+static int64_t days_from_civil (int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = static_cast<unsigned>(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+// IMF-fixdate only ("Sun, 06 Nov 1994 08:49:37 GMT"), the only format we generate. Returns unix time or -1 if invalid.
+static int64_t parse_http_date (const string& s) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    if (s.length() != 29 || s[3] != ',' || s[4] != ' ' || s[7] != ' ' || s[11] != ' ' || s[16] != ' ' || s[19] != ':' || s[22] != ':' ||
+        s.substr(25) != " GMT") return -1;
+
+    auto num = [&](size_t pos, size_t len) { return parse_number(s.substr(pos, len)); };
+    auto mday = num(5, 2), year = num(12, 4), hour = num(17, 2), min = num(20, 2), sec = num(23, 2);
+    if (mday < 1 || year < 0 || hour < 0 || min < 0 || sec < 0) return -1;
+
+    unsigned mon = 0;
+    while (mon < 12 && string(months + mon * 3, 3) != s.substr(8, 3)) ++mon;
+    if (mon == 12) return -1;
+
+    return days_from_civil(year, mon + 1, mday) * 86400 + hour * 3600 + min * 60 + sec;
+}
+
+static bool etag_matches (const string& list, const string& etag) {
+    if (!etag) return false;
+    auto strip = [](const string& tag) { return tag.length() > 2 && tag[0] == 'W' && tag[1] == '/' ? tag.substr(2) : tag; }; // weak comparison
+    auto tag = strip(etag);
+    bool ret = false;
+    for_each_token(list, [&](const string& t) {
+        if (t == "*" || strip(t) == tag) ret = true;
+    });
+    return ret;
+}
+
+static bool cacheable_code (int code) {
+    switch (code) {
+        case 200: case 203: case 204: case 300: case 301: case 308: case 404: case 405: case 410: case 414: case 501: return true;
+        default: return false;
+    }
+}
+
+ResponseCache::ResponseCache (Server* server, size_t max_size, size_t max_entry_size)
+    : _server(server), _max_size(max_size), _max_entry_size(max_entry_size) {}
+
+void ResponseCache::limits (size_t max_size, size_t max_entry_size) {
+    _max_size       = max_size;
+    _max_entry_size = max_entry_size;
+    evict();
+}
+
+void ResponseCache::clear () {
+    _lru.clear();
+    _index.clear();
+    _size = 0;
+}
+
+bool ResponseCache::serve (const ServerRequestSP& req, bool coalesce) {
+    if (!_max_size) return false;
+    auto method = req->method_raw();
+    if (method != Method::Get && method != Method::Head) return false;
+    if (req->headers.has("Authorization")) return false;
+    auto cc = parse_cache_control(req->headers.get("Cache-Control"));
+    if (cc.no_store || cc.no_cache || iequals(req->headers.get("Pragma"), "no-cache")) return false;
+
+    string key = req->headers.get("Host");
+    key += ' ';
+    key += req->uri->to_string();
+
+    auto it = find(key, req);
+    if (it != _lru.end()) {
+        ++_stats.hits;
+        respond(*it, req);
+        return true;
+    }
+
+    if (method == Method::Get && coalesce) { // response to HEAD has no body to store
+        auto p = _pending.find(key);
+        if (p != _pending.end()) {
+            ++_stats.coalesced;
+            p->second.push_back(req);
+            return true;
+        }
+    }
+
+    ++_stats.misses;
+    if (method == Method::Head || !coalesce) return false;
+
+    _pending.emplace(key, Waiters());
+    req->finish_event.add([this, key](const ServerRequestSP& req) { on_finish(key, req); });
+    return false;
+}
+
+void ResponseCache::respond (const Entry& e, const ServerRequestSP& req) {
+    bool not_modified;
+    auto inm = req->headers.get("If-None-Match");
+    if (inm) not_modified = etag_matches(inm, e.etag); // If-Modified-Since is ignored when If-None-Match is present
+    else {
+        auto ims = e.last_modified ? parse_http_date(req->headers.get("If-Modified-Since")) : -1;
+        not_modified = ims >= 0 && e.last_modified <= ims;
+    }
+
+    if (not_modified) {
+        ++_stats.not_modified;
+        req->respond(e.not_modified);
+    }
+    else req->respond(e.response);
+}
+
+void ResponseCache::on_finish (const string& key, const ServerRequestSP& req) {
+    auto p = _pending.find(key);
+    if (p == _pending.end()) return;
+    auto waiters = std::move(p->second);
+    _pending.erase(p);
+
+    auto& res = req->response();
+    bool stored = res && res->completed() && store(key, req, res);
+    if (!waiters.size()) return;
+
+    // if response is stored or there is no response at all (request dropped), waiters go through cache again (one of them may become
+    // the next leader), otherwise response is not cacheable and every waiter goes to user.
+    bool coalesce = stored || !res || !res->completed();
+
+    // we are inside of leader connection's request processing, so waiters are processed on the next loop iteration
+    ServerSP hold = _server;
+    _server->loop()->delay([this, hold, waiters, coalesce] {
+        for (auto& w : waiters) {
+            if (!w->connection()) continue; // client has gone
+            if (!serve(w, coalesce)) _server->request_event(w);
+        }
+    });
+}
+
+bool ResponseCache::store (const string& key, const ServerRequestSP& req, const ServerResponseSP& res) {
+    if (!cacheable_code(res->code) || res->chunked || res->frozen() || res->compression.type != Compression::IDENTITY) return false;
+
+    auto& h = res->headers;
+    if (h.has("Set-Cookie")) return false;
+
+    auto cc = parse_cache_control(h.get("Cache-Control"));
+    if (cc.no_store || cc.no_cache || cc.priv) return false;
+    int64_t ttl = cc.s_maxage >= 0 ? cc.s_maxage : cc.max_age;
+    if (ttl < 0 && h.has("Expires")) {
+        auto expires = parse_http_date(h.get("Expires"));
+        ttl = expires < 0 ? 0 : expires - static_cast<int64_t>(std::time(0)); // invalid Expires means "already expired"
+    }
+    if (ttl <= 0) return false;
+
+    Entry e;
+    bool vary_all = false;
+    for_each_token(h.get("Vary"), [&](const string& name) {
+        if (name == "*") vary_all = true;
+        else e.vary.emplace_back(name, req->headers.get(name));
+    });
+    if (vary_all) return false;
+
+    e.size = sizeof(Entry) + key.length() + res->body.length();
+    for (auto& f : h.fields) e.size += f.name.length() + f.value.length() + 4;
+    if (e.size > _max_entry_size) return false;
+
+    e.key           = key;
+    e.etag          = h.get("ETag");
+    e.last_modified = h.has("Last-Modified") ? std::max<int64_t>(parse_http_date(h.get("Last-Modified")), 0) : 0;
+    e.expires       = _server->loop()->now() + ttl * 1000;
+
+    // user's response is left intact, it may be reused
+    Headers headers, nm_headers;
+    for (auto& f : h.fields) {
+        if (iequals(f.name, "Connection")) continue; // might be forced by leader's connection state
+        headers.add(f.name, f.value);
+        if (iequals(f.name, "ETag") || iequals(f.name, "Cache-Control") || iequals(f.name, "Expires") || iequals(f.name, "Vary") ||
+            iequals(f.name, "Last-Modified") || iequals(f.name, "Content-Location")) nm_headers.add(f.name, f.value);
+    }
+    e.response = new ServerResponse(res->code, std::move(headers), Body(res->body), false, res->http_version, res->message);
+    e.response->freeze();
+    e.not_modified = new ServerResponse(304, std::move(nm_headers), Body(), false, res->http_version);
+    e.not_modified->freeze();
+
+    // replace the same variant if any
+    auto ii = _index.find(key);
+    if (ii != _index.end()) {
+        for (auto it : ii->second) {
+            if (it->vary != e.vary) continue;
+            erase(it);
+            break;
+        }
+    }
+
+    _size += e.size;
+    _lru.push_front(std::move(e));
+    _index[key].push_back(_lru.begin());
+    ++_stats.stored;
+    evict();
+    return true;
+}
+
+ResponseCache::Lru::iterator ResponseCache::find (const string& key, const ServerRequestSP& req) {
+    auto ii = _index.find(key);
+    if (ii == _index.end()) return _lru.end();
+
+    for (auto it : ii->second) {
+        bool match = true;
+        for (auto& v : it->vary) if (req->headers.get(v.first) != v.second) { match = false; break; }
+        if (!match) continue;
+
+        if (it->expires <= _server->loop()->now()) {
+            erase(it);
+            return _lru.end();
+        }
+        _lru.splice(_lru.begin(), _lru, it);
+        return it;
+    }
+    return _lru.end();
+}
+
+void ResponseCache::erase (Lru::iterator it) {
+    auto ii = _index.find(it->key);
+    auto& variants = ii->second;
+    variants.erase(std::find(variants.begin(), variants.end(), it));
+    if (!variants.size()) _index.erase(ii);
+    _size -= it->size;
+    _lru.erase(it);
+}
+
+void ResponseCache::evict () {
+    while (_size > _max_size && _lru.size()) {
+        erase(std::prev(_lru.end()));
+        ++_stats.evicted;
+    }
+}
+
+}}}
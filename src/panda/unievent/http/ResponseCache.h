@@ -0,0 +1,82 @@
+#pragma once
+#include "ServerRequest.h"
+#include "ServerResponse.h"
+#include <list>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+namespace panda { namespace unievent { namespace http {
+
+struct Server;
+
+// In-process cache of server responses, sits between connections and Server::request_event. Enabled by Server::Config::cache_size.
+// Only GET responses with explicit freshness (Cache-Control: max-age/s-maxage or Expires) are stored, keyed by Host + URI and
+// request headers listed in Vary. Cached responses are served frozen (see ServerResponse::freeze()), conditional requests
+// (If-None-Match, If-Modified-Since) get 304 without calling user. Concurrent misses for the same key are coalesced: only the first
+// request goes to user, the rest wait for its response. Memory is bounded by LRU eviction.
+struct ResponseCache {
+    struct Stats {
+        uint64_t hits         = 0;
+        uint64_t not_modified = 0; // hits answered with 304
+        uint64_t misses       = 0;
+        uint64_t coalesced    = 0; // requests which waited for in-flight identical request, they are counted as hit or miss afterwards
+        uint64_t stored       = 0;
+        uint64_t evicted      = 0;
+    };
+
+    ResponseCache (Server*, size_t max_size, size_t max_entry_size);
+
+    size_t size  () const { return _size; } // [bytes]
+    size_t count () const { return _lru.size(); }
+
+    size_t max_size       () const { return _max_size; }
+    size_t max_entry_size () const { return _max_entry_size; }
+    void   limits         (size_t max_size, size_t max_entry_size);
+
+    const Stats& stats () const { return _stats; }
+
+    void clear ();
+
+    // returns true if request is answered from cache or waits for the response to identical request, otherwise it should go to user
+    bool serve (const ServerRequestSP& req) { return serve(req, true); }
+
+private:
+    using VaryValues = std::vector<std::pair<string, string>>; // header name -> request's value
+
+    struct Entry {
+        string           key;
+        VaryValues       vary;
+        ServerResponseSP response;     // frozen
+        ServerResponseSP not_modified; // frozen 304 with validators and cache headers
+        string           etag;
+        int64_t          last_modified; // [unix time], 0 if none
+        uint64_t         expires;       // [loop time ms]
+        size_t           size;
+    };
+    using Lru      = std::list<Entry>;
+    using Variants = std::vector<Lru::iterator>;
+    using Waiters  = std::vector<ServerRequestSP>;
+
+    Server*                              _server;
+    size_t                               _max_size;
+    size_t                               _max_entry_size;
+    size_t                               _size = 0;
+    Lru                                  _lru;     // most recently used first
+    std::unordered_map<string, Variants> _index;
+    std::unordered_map<string, Waiters>  _pending; // keys with a request being processed by user
+    Stats                                _stats;
+
+    bool          serve     (const ServerRequestSP&, bool coalesce);
+    void          respond   (const Entry&, const ServerRequestSP&);
+    void          on_finish (const string& key, const ServerRequestSP&);
+    bool          store     (const string& key, const ServerRequestSP&, const ServerResponseSP&);
+    Lru::iterator find      (const string& key, const ServerRequestSP&);
+    void          erase     (Lru::iterator);
+    void          evict     ();
+
+    ResponseCache (const ResponseCache&) = delete;
+    ResponseCache& operator= (const ResponseCache&) = delete;
+};
+
+}}}
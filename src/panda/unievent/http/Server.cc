@@ -5,6 +5,7 @@
 #include <panda/unievent/Fs.h>
 #include <panda/unievent/Tcp.h>
 #include <panda/unievent/Pipe.h>
+#include <openssl/ssl.h>
 
 namespace panda { namespace unievent { namespace http {
 
@@ -12,7 +13,16 @@ string rfc822_date (time::ptime_t);
 
 std::atomic<uint64_t> Server::lastid(0);
 
-Server::Server (const LoopSP& loop, IFactory* fac) : _loop(loop), _factory(fac) {}
+// only HTTP/1.1 is spoken, so it is selected explicitly and clients offering h2 know it at handshake time
+static int select_alpn (SSL*, const unsigned char** out, unsigned char* outlen, const unsigned char* in, unsigned inlen, void*) {
+    static const unsigned char protos[] = "\x08http/1.1";
+    unsigned char* selected;
+    if (SSL_select_next_proto(&selected, outlen, protos, sizeof(protos) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED) return SSL_TLSEXT_ERR_NOACK;
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+Server::Server (const LoopSP& loop, IFactory* fac) : _loop(loop), _factory(fac), _idle_wheel(loop), _metrics(std::make_shared<ServerMetrics>()) {}
 
 Server::Server (const Config& conf, const LoopSP& loop, IFactory* fac) : Server(loop, fac) {
     configure(conf);
@@ -22,7 +32,7 @@ Server::~Server() {
     // close all connections to stop any delayed callbacks and self holdings, e.g. on_write. Connections should not leave longer than Server.
     // it can not lead to user callback because active http::Requests are impossible in Server dtor, so no retry or any sort of infinite loop
     while (_connections.size()) {
-        _connections.begin()->second->close(make_error_code(std::errc::connection_reset));
+        _connections.back()->close(make_error_code(std::errc::connection_reset));
     }
 }
 
@@ -36,6 +46,13 @@ void Server::configure (const Config& conf) {
     if (running()) stop_listening();
 
     _conf = conf;
+    // idle timeouts may fire up to 1/16 of timeout later (but not more than 1s)
+    if (_conf.idle_timeout) _idle_wheel.tick(std::min<uint32_t>(std::max<uint32_t>(_conf.idle_timeout / 16, 1), 1000));
+
+    // once created, cache lives as long as server, because requests in flight refer to it
+    if (_cache) _cache->limits(_conf.cache_size, _conf.cache_max_entry);
+    else if (_conf.cache_size) _cache.reset(new ResponseCache(this, _conf.cache_size, _conf.cache_max_entry));
+
     for (auto& loc : _conf.locations) {
         if (!loc.backlog) loc.backlog = DEFAULT_BACKLOG;
         if (conf.tcp_nodelay) loc.tcp_nodelay = true;
@@ -55,7 +72,7 @@ void Server::stop () {
     if (!running() && _state != State::stopping) return;
     stop_listening();
     panda_log_notice("stopping HTTP server with " << _connections.size() << " connections");
-    while (_connections.size()) _connections.begin()->second->close(errc::server_stopping);
+    while (_connections.size()) _connections.back()->close(errc::server_stopping);
     _state = State::initial;
     stop_event();
 }
@@ -66,8 +83,7 @@ void Server::graceful_stop () {
     stop_listening();
     panda_log_notice("gracefully stopping HTTP server with " << _connections.size() << " connections");
 
-    std::vector<ServerConnectionSP> list;
-    for (auto& row : _connections) list.push_back(row.second);
+    auto list = _connections; // graceful_stop() may remove connection
     for (auto& conn : list) conn->graceful_stop();
     _stop_if_done();
 }
@@ -123,7 +139,10 @@ void Server::start_listening () {
         }
 
         lst->listen(loc.backlog);
-        if (loc.ssl_ctx) lst->use_ssl(loc.ssl_ctx);
+        if (loc.ssl_ctx) {
+            if (loc.alpn) SSL_CTX_set_alpn_select_cb(loc.ssl_ctx, select_alpn, nullptr);
+            lst->use_ssl(loc.ssl_ctx);
+        }
 
         lst->event_listener(this);
 
@@ -166,7 +185,8 @@ void Server::on_establish(const StreamSP&, const StreamSP& stream, const ErrorCo
     if (err) return;
     ServerConnection::Config cfg {_conf.idle_timeout, _conf.max_keepalive_requests, _conf.max_headers_size, _conf.max_body_size, _factory};
     auto connection = new_connection(++lastid, cfg, stream);
-    _connections[connection->id()] = connection;
+    ++_metrics->accepted;
+    add(connection);
     connect_event(connection);
     panda_log_info([&]{
         log << "client connected to ";
@@ -179,6 +199,13 @@ void Server::on_establish(const StreamSP&, const StreamSP& stream, const ErrorCo
     });
 }
 
+bool Server::serve_metrics (const ServerRequestSP& req) {
+    if (!metrics_request(req)) return false;
+    auto snapshot = _metrics_source ? _metrics_source() : _metrics->snapshot();
+    req->respond(new ServerResponse(200, Headers().add("Content-Type", "text/plain; version=0.0.4"), Body(snapshot.to_prometheus())));
+    return true;
+}
+
 const string& Server::date_header_now () {
     if (!_hdate_time || _hdate_time <= _loop->now() - 1000) {
         _hdate_time = _loop->now();
@@ -257,6 +284,7 @@ std::ostream& operator<< (std::ostream& os, const Server::Location& location) {
         os << ", tcp_nodelay: " << location.tcp_nodelay;
     }
     os << ", backlog: " << location.backlog;
+    if (location.alpn) os << ", alpn: http/1.1";
     os << "}";
     return os;
 }
@@ -268,6 +296,8 @@ std::ostream& operator<< (std::ostream& os, const Server::Config& conf) {
     if (conf.max_body_size != panda::protocol::http::SIZE_UNLIMITED) os << ", max_body_size: " << conf.max_body_size;
     if (conf.max_keepalive_requests) os << ", max_keepalive_requests: " << conf.max_keepalive_requests;
     os << ", tcp_nodelay: " << conf.tcp_nodelay;
+    if (conf.cache_size) os << ", cache_size: " << conf.cache_size << ", cache_max_entry: " << conf.cache_max_entry;
+    if (conf.metrics_path) os << ", metrics_path: " << conf.metrics_path;
     os << ", locations: [";
     for (auto loc : conf.locations) os << loc << ", ";
     os << "]}";
@@ -276,12 +306,13 @@ std::ostream& operator<< (std::ostream& os, const Server::Config& conf) {
 
 bool Server::Location::operator== (const Location& oth) const {
     return host == oth.host && port == oth.port && path == oth.path && reuse_port == oth.reuse_port && backlog == oth.backlog &&
-           domain == oth.domain && ssl_ctx == oth.ssl_ctx && sock == oth.sock && tcp_nodelay == oth.tcp_nodelay;
+           domain == oth.domain && ssl_ctx == oth.ssl_ctx && sock == oth.sock && tcp_nodelay == oth.tcp_nodelay && alpn == oth.alpn;
 }
 
 bool Server::Config::operator== (const Config& oth) const {
     return idle_timeout == oth.idle_timeout && max_headers_size == oth.max_headers_size && max_body_size == oth.max_body_size &&
            tcp_nodelay == oth.tcp_nodelay && max_keepalive_requests == oth.max_keepalive_requests &&
+           cache_size == oth.cache_size && cache_max_entry == oth.cache_max_entry && metrics_path == oth.metrics_path &&
            locations.size() == oth.locations.size() && std::equal(locations.begin(), locations.end(), oth.locations.begin());
 }
 
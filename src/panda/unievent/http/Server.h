@@ -1,10 +1,13 @@
 #pragma once
 #include "error.h"
+#include "ResponseCache.h"
+#include "ServerMetrics.h"
 #include "ServerConnection.h"
-#include <map>
 #include <iosfwd>
+#include <memory>
 #include <vector>
 #include <atomic>
+#include <functional>
 
 namespace panda { namespace unievent { namespace http {
 
@@ -15,6 +18,7 @@ struct Server : Refcnt, private IStreamListener {
     static constexpr const uint32_t DEFAULT_IDLE_TIMEOUT     = 300000; // [ms]
     static constexpr const size_t   DEFAULT_MAX_HEADERS_SIZE = 16384;
     static constexpr const size_t   DEFAULT_MAX_BODY_SIZE    = SIZE_UNLIMITED;
+    static constexpr const size_t   DEFAULT_CACHE_MAX_ENTRY  = 1024 * 1024;
 
     #ifdef _WIN32
     static constexpr const bool DEFRPORT = false;
@@ -31,6 +35,7 @@ struct Server : Refcnt, private IStreamListener {
         int              domain      = AF_INET;
         bool             tcp_nodelay = false;           // if the location is a tcp location, enables tcp nodelay feature
         SslContext       ssl_ctx     = nullptr;         // if set, will use SSL
+        bool             alpn        = false;           // select http/1.1 via ALPN, replaces ALPN select callback of ssl_ctx
         optional<sock_t> sock        = {};              // if supplied, uses this socket and ignores host, port, path, reuse_port, backlog, domain
                                                         // socket must be bound but NOT LISTENING!
 
@@ -48,6 +53,7 @@ struct Server : Refcnt, private IStreamListener {
         Location& set_ssl_ctx    (const SslContext& val) { ssl_ctx = val; return *this; }
         Location& set_sock       (sock_t val)            { sock = val; return *this; }
         Location& set_tcp_nodelay(bool val)              { tcp_nodelay = val; return *this; }
+        Location& set_alpn       (bool val)              { alpn = val; return *this; }
 
         bool operator== (const Location&) const;
         bool operator!= (const Location& oth) const { return !operator==(oth); }
@@ -61,6 +67,10 @@ struct Server : Refcnt, private IStreamListener {
         size_t    max_body_size          = DEFAULT_MAX_BODY_SIZE;    // 0 = unlimited
         bool      tcp_nodelay            = false;
         uint32_t  max_keepalive_requests = 0;                        // respond with "connection: close" in KA connection after that number of requests (0 = unlimited)
+        size_t    cache_size             = 0;                        // max total size of response cache [bytes], 0 = no cache, see ResponseCache
+        size_t    cache_max_entry        = DEFAULT_CACHE_MAX_ENTRY;  // larger responses are not cached [bytes]
+        string    metrics_path;                                      // requests to this path are answered with metrics() in Prometheus
+                                                                     // text format instead of going to user, empty = disabled
 
         bool operator== (const Config&) const;
         bool operator!= (const Config& oth) const { return !operator==(oth); }
@@ -81,6 +91,7 @@ struct Server : Refcnt, private IStreamListener {
     using stop_fn      = function<stop_fptr>;
     using connect_fn   = function<connect_fptr>;
     using IFactory     = ServerConnection::IFactory;
+    using metrics_fn   = std::function<ServerMetrics::Snapshot()>;
 
     CallbackDispatcher<run_fptr>     run_event;
     CallbackDispatcher<route_fptr>   route_event;
@@ -111,6 +122,15 @@ struct Server : Refcnt, private IStreamListener {
 
     const string& date_header_now ();
 
+    ResponseCache* cache () const { return _cache.get(); } // nullptr if cache was never enabled
+
+    // may be read from any thread, also after server is destroyed if shared_metrics() is held
+    const ServerMetrics&                  metrics        () const { return *_metrics; }
+    std::shared_ptr<const ServerMetrics> shared_metrics () const { return _metrics; }
+
+    // what is exported via Config::metrics_path, server's own metrics by default. MultiServer sums up metrics of all workers.
+    void metrics_source (const metrics_fn& fn) { _metrics_source = fn; }
+
 protected:
     virtual ServerConnectionSP new_connection (uint64_t id, const ServerConnection::Config&, const StreamSP&);
 
@@ -120,7 +140,7 @@ private:
     enum class State { initial, running, stopping };
     friend ServerConnection;
     using Locations   = std::vector<Location>;
-    using Connections = std::map<uint64_t, ServerConnectionSP>;
+    using Connections = std::vector<ServerConnectionSP>; // unordered, connection knows its slot, so add/remove are O(1) without allocations
 
     static std::atomic<uint64_t> lastid;
 
@@ -130,13 +150,34 @@ private:
     Listeners   _listeners;
     State       _state = State::initial;
     Connections _connections;
+    TimerWheel  _idle_wheel; // shared by all connections' idle timeouts
     uint64_t    _hdate_time = 0;
     string      _hdate_str;
 
+    std::unique_ptr<ResponseCache> _cache;
+    std::shared_ptr<ServerMetrics> _metrics;
+    metrics_fn                     _metrics_source;
+
     void on_establish(const StreamSP&, const StreamSP&, const ErrorCode&) override;
 
+    bool metrics_request (const ServerRequestSP& req) const { return _conf.metrics_path && req->uri->path() == _conf.metrics_path; }
+    bool serve_metrics   (const ServerRequestSP&);
+
+    void add (const ServerConnectionSP& conn) {
+        conn->_slot = _connections.size();
+        _connections.push_back(conn);
+        _metrics->active.set(_connections.size());
+    }
+
     void remove (const ServerConnectionSP& conn) {
-        _connections.erase(conn->id());
+        auto pos = conn->_slot;
+        if (pos >= _connections.size() || _connections[pos] != conn) return; // already removed
+        if (pos != _connections.size() - 1) {
+            _connections[pos] = std::move(_connections.back());
+            _connections[pos]->_slot = pos;
+        }
+        _connections.pop_back();
+        _metrics->active.set(_connections.size());
         if (_state == State::stopping) _stop_if_done();
     }
 
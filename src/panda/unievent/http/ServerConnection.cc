@@ -4,9 +4,14 @@
 #include "panda/unievent/forward.h"
 #include <panda/unievent/Tcp.h>
 #include <panda/unievent/Pipe.h>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
 
 namespace panda { namespace unievent { namespace http {
 
+static const char H2_PREFACE[] = "PRI * HTTP/2.0\r\n"; // start of HTTP/2 connection preface (prior knowledge, RFC 7540 3.4)
+
 excepted<net::SockAddr, ErrorCode> get_sockaddr (const Stream* stream) {
     if (stream->type() == Tcp::TYPE) return panda::dyn_cast<const Tcp*>(stream)->sockaddr();
 
@@ -41,15 +46,27 @@ ServerConnection::ServerConnection (Server* server, uint64_t id, const Config& c
     parser.max_body_size    = conf.max_body_size;
 
     if (idle_timeout) {
-        idle_timer = new Timer(server->loop());
-        idle_timer->event.add([this](auto&){
-            assert(!requests.size());
-            close({});
-        });
-        idle_timer->once(idle_timeout);
+        idle_entry      = server->_idle_wheel.add(this);
+        idle_registered = true;
+        server->_idle_wheel.arm(idle_entry, idle_timeout);
     }
 }
 
+void ServerConnection::on_wheel_timeout () {
+    assert(!requests.size());
+    close({});
+}
+
+void ServerConnection::idle_disarm () {
+    if (idle_registered) server->_idle_wheel.disarm(idle_entry);
+}
+
+void ServerConnection::idle_remove () {
+    if (!idle_registered) return;
+    idle_registered = false;
+    server->_idle_wheel.remove(idle_entry);
+}
+
 void ServerConnection::on_connection(const StreamSP&, const ErrorCode& err) {
     if (!err) return;
     panda_log_notice("on connection error: " << err);
@@ -63,26 +80,55 @@ protocol::http::RequestSP ServerConnection::new_request () {
 void ServerConnection::on_read (string& buf, const ErrorCode& err) {
     ServerSP holdsrv = server; // protect against user loosing all server refs in one of the callbacks
     ServerConnectionSP hold = this; // finish_request may remove this connection
-    panda_log_debug("recv: \n" << buf);
+    Cork cork(this); // all responses given synchronously (i.e. for pipelined requests) are sent at once
+    panda_log_debug("recv " << buf.length() << " bytes");
 
     if (err) {
-        if (idle_timer) idle_timer->stop();
+        idle_disarm();
         panda_log_notice("read error: " << err);
         if (!requests.size() || requests.back()->is_done()) requests.emplace_back(static_pointer_cast<ServerRequest>(new_request()));
         requests.back()->_is_done = true;
         return request_error(requests.back(), err);
     }
 
+    auto& metrics = *server->_metrics;
+    auto  now     = std::chrono::steady_clock::now();
+    metrics.bytes_in.add(buf.length());
+
+    // h2c upgrade requests ("Upgrade: h2c") are just answered in HTTP/1.1, but prior knowledge clients start with the preface.
+    // First bytes are held until they can be compared with it, no HTTP/1 method starts with "PRI ".
+    if (!preface_checked) {
+        if (preface_buf) {
+            preface_buf += buf;
+            buf = preface_buf;
+            preface_buf.clear();
+        }
+        auto n = std::min(buf.length(), sizeof(H2_PREFACE) - 1);
+        if (memcmp(buf.data(), H2_PREFACE, n)) preface_checked = true;
+        else if (n == sizeof(H2_PREFACE) - 1) return refuse_http2();
+        else {
+            preface_buf = buf;
+            return;
+        }
+    }
+
     while (buf) {
-        if (idle_timer) idle_timer->stop(); // we must stop timer every request because user might have responded to previous and timer might have been activated again
+        idle_disarm(); // we must disarm every request because user might have responded to previous and timer might have been armed again
         auto result = parser.parse_shift(buf);
 
         auto req = static_pointer_cast<ServerRequest>(result.request);
-        if (!requests.size() || requests.back() != req) requests.emplace_back(req);
+        if (!requests.size() || requests.back() != req) {
+            req->_received_at = now;
+            if (Tracer::enabled()) req->_trace_start = Tracer::now();
+            requests.emplace_back(req);
+            if (requests_received++) ++metrics.keepalive_reuse;
+            metrics.queued(requests.size());
+        }
         req->_is_done = result.state >= protocol::http::State::done;
 
         if (result.error) {
             panda_log_notice("parser error: " << result.error);
+            ++metrics.parse_errors;
             return request_error(req, result.error);
         }
 
@@ -100,21 +146,32 @@ void ServerConnection::on_read (string& buf, const ErrorCode& err) {
             break;
         }
 
+        if (!req->_routed && req->_trace_start) start_span(req);
+
+        // client requests made from user's callbacks become children of this request's span
+        Tracer::Scope scope(req->_span);
+
         if (!req->_routed) {
             req->_routed = true;
             req->_server = server; // hold server until request completed
-            server->route_event(req);
+            UEHT_TRACE(req->_span, "route");
+            if (!server->metrics_request(req)) server->route_event(req);
         }
 
+        if (result.state == protocol::http::State::done) UEHT_TRACE(req->_span, "parse_end");
+
         if (req->_partial) {
             req->partial_event(req, {});
         }
         else if (result.state == protocol::http::State::done) {
-            req->receive_event(req);
-            server->request_event(req);
+            if (!server->serve_metrics(req)) { // metrics requests never reach user
+                req->receive_event(req);
+                if (!server->_cache || req->_response || !server->_cache->serve(req)) server->request_event(req);
+            }
         }
 
         if (result.state == protocol::http::State::done) {
+            ++metrics.requests;
             // if request is non-KA or non-KA response is already started, stop receiving any further requests
             if (req->_finish_on_receive) finish_request();
             else if (closing || !req->keep_alive()) {
@@ -125,11 +182,15 @@ void ServerConnection::on_read (string& buf, const ErrorCode& err) {
     }
 }
 
-void ServerConnection::respond (const ServerRequestSP& req, const ServerResponseSP& res) {
+void ServerConnection::respond (const ServerRequestSP& req, const ServerResponseSP& user_res) {
     ServerConnectionSP hold = this; (void)hold;
+    // frozen response is shared between requests, every request gets its own light copy
+    auto res = user_res->frozen() ? user_res->instance() : user_res;
+    Cork cork(this);
     assert(req->_connection == this);
     panda_log_info("respond " << req << "," << res << "," << requests.front());
     if (req->_response) throw HttpError("double response for request given");
+    UEHT_TRACE(req->_span, "respond");
     req->_response = res;
     res->_request = req;
 
@@ -146,22 +207,34 @@ void ServerConnection::respond (const ServerRequestSP& req, const ServerResponse
 void ServerConnection::write_next_response () {
     auto req = requests.front();
     auto res = req->_response;
-
-    if (!res->code) res->code = 200;
-    if (!res->headers.has("Date")) res->headers.date(server->date_header_now());
+    bool keep_alive;
 
     decltype(res->body.parts) tmp_chunks;
-    if (res->chunked && !res->_completed && res->body.length()) {
-        tmp_chunks = std::move(res->body.parts);
-        res->body.parts.clear();
-    }
 
-    panda_log_debug("sending <<\n" << res->to_string(req));
+    if (res->_frozen) {
+        keep_alive = write_frozen(req, res);
+    } else {
+        if (!res->code) res->code = 200;
+        if (!res->headers.has("Date")) res->headers.date(server->date_header_now());
+
+        if (res->chunked && !res->_completed && res->body.length()) {
+            tmp_chunks = std::move(res->body.parts);
+            res->body.parts.clear();
+        }
+
+        panda_log_debug("sending <<\n" << res->to_string(req));
 
-    auto v = res->to_vector(req);
-    stream->write(v.begin(), v.end());
+        auto v = res->to_vector(req);
+        write(std::make_move_iterator(v.begin()), std::make_move_iterator(v.end()));
+        keep_alive = res->keep_alive() && req->keep_alive();
+    }
+    server->_metrics->response(res->code);
+    if (req->_span) {
+        req->_span->event("first_write");
+        req->_span->status_code = res->code;
+    }
 
-    if (!res->keep_alive() || !req->keep_alive()) {
+    if (!keep_alive) {
         closing = true;
 
         // stop accepting further requests if this request is fully received.
@@ -177,10 +250,7 @@ void ServerConnection::write_next_response () {
 
     if (!res->_completed) {
         if (tmp_chunks.size()) {
-            for (auto& chunk : tmp_chunks) {
-                auto v = res->make_chunk(chunk);
-                stream->write(v.begin(), v.end());
-            }
+            for (auto& chunk : tmp_chunks) write_chunk(res, chunk);
         }
         return;
     }
@@ -188,13 +258,33 @@ void ServerConnection::write_next_response () {
     finish_request();
 }
 
+bool ServerConnection::write_frozen (const ServerRequestSP& req, const ServerResponseSP& res) {
+    static const string tail_close = "\r\nConnection: close\r\n\r\n";
+    static const string tail_ka    = "\r\nConnection: keep-alive\r\n\r\n";
+    static const string tail       = "\r\n\r\n";
+
+    auto& fr = *res->_frozen;
+    // per-request Connection header might be set on the instance by graceful stop or request error
+    bool keep_alive = fr.keep_alive && req->keep_alive() && !protocol::http::iequals(res->headers.connection(), "close");
+    bool v10 = req->http_version == 10;
+
+    panda_log_debug("sending frozen response " << res->code << ", keep-alive: " << keep_alive);
+
+    // HTTP/1.0 on either side needs explicit keep-alive
+    string head[] = {fr.head[v10 ? 0 : 1], server->date_header_now(), !keep_alive ? tail_close : (v10 || res->http_version == 10) ? tail_ka : tail};
+    write(std::begin(head), std::end(head));
+    if (req->method_raw() != protocol::http::Request::Method::Head) write(fr.body.begin(), fr.body.end());
+
+    return keep_alive;
+}
+
 void ServerConnection::send_continue (const ServerRequestSP& req) {
     assert(requests.size());
     if (requests.front() != req) return; // do not send 100 in pipeline
     if (!req->expects_continue() || req->http_version == 10) return; // client doesn't expect 100
     if (req->_response) throw HttpError("100-continue can only be sent before response");
 
-    stream->write("HTTP/1.1 100 Continue\r\n\r\n");
+    write("HTTP/1.1 100 Continue\r\n\r\n");
 }
 
 void ServerConnection::send_chunk (const ServerResponseSP& res, const string& chunk) {
@@ -202,8 +292,7 @@ void ServerConnection::send_chunk (const ServerResponseSP& res, const string& ch
     if (!chunk) return;
 
     if (requests.front()->_response == res) {
-        auto v = res->make_chunk(chunk);
-        stream->write(v.begin(), v.end());
+        write_chunk(res, chunk);
         return;
     }
 
@@ -215,11 +304,30 @@ void ServerConnection::send_final_chunk (const ServerResponseSP& res, const stri
     res->_completed = true;
     if (requests.front()->_response != res) return;
 
+    ServerConnectionSP hold = this; (void)hold;
+    Cork cork(this); // final chunk and next pipelined responses go together
     auto v = res->final_chunk(chunk);
-    stream->write(v.begin(), v.end());
+    write(std::make_move_iterator(v.begin()), std::make_move_iterator(v.end()));
     finish_request();
 }
 
+// uncompressed chunk is framed right in the write buffer instead of a vector from make_chunk()
+void ServerConnection::write_chunk (const ServerResponseSP& res, const string& chunk) {
+    static const string crlf = "\r\n";
+    if (!chunk) return;
+    if (res->compression.type != Compression::IDENTITY) {
+        auto v = res->make_chunk(chunk);
+        write(std::make_move_iterator(v.begin()), std::make_move_iterator(v.end()));
+        return;
+    }
+    auto size = string::from_number(chunk.length(), 16); // fits into small string buffer
+    size += crlf;
+    wbuf.push_back(std::move(size));
+    wbuf.push_back(chunk);
+    wbuf.push_back(crlf);
+    if (!corked) flush();
+}
+
 void ServerConnection::finish_request () {
     ServerSP holdsrv = server; (void)holdsrv; // cleanup_request() may release last server ref
 
@@ -231,6 +339,11 @@ void ServerConnection::finish_request () {
         return;
     }
 
+    // latency is measured when the end of response is actually written
+    auto write_no = writes_sent + (wbuf.size() ? 1 : 0);
+    if (write_no > writes_done) latency_marks.emplace_back(write_no, req->_received_at);
+    else record_latency(req->_received_at);
+
     cleanup_request();
 
     if (closing || stopping) {
@@ -247,34 +360,72 @@ void ServerConnection::finish_request () {
     }
 }
 
-void ServerConnection::cleanup_request () {
+void ServerConnection::cleanup_request (const ErrorCode& err) {
     auto req = requests.front();
     req->_connection = nullptr;
     req->_server = nullptr; // release server
     requests.pop_front();
+    if (req->_span) {
+        if (err) {
+            req->_span->event("drop");
+            req->_span->error = err;
+        }
+        Tracer::finish(req->_span);
+    }
     req->finish_event(req);
 }
 
+// span starts at the first byte of request, its parent is taken from traceparent header (if any)
+void ServerConnection::start_span (const ServerRequestSP& req) {
+    auto parent = TraceContext::parse(req->headers.get("traceparent"));
+    req->_span = Tracer::start(TraceSpan::Kind::server, parent.valid() ? &parent : nullptr, req->_trace_start);
+    if (!req->_span) return;
+    req->_span->request(*req);
+    req->_span->event("parse_start", req->_trace_start);
+    req->_span->event("parse_headers");
+}
+
+void ServerConnection::flush () {
+    if (!wbuf.size()) return;
+    size_t len = 0;
+    for (auto& buf : wbuf) len += buf.length();
+    server->_metrics->bytes_out.add(len);
+    ++writes_sent;
+    stream->write(wbuf.begin(), wbuf.end());
+    wbuf.clear();
+}
+
+void ServerConnection::record_latency (std::chrono::steady_clock::time_point start) {
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    server->_metrics->latency.add(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+}
+
 void ServerConnection::check_if_idle() {
-    if (!requests.size() && !idle_timer->active() && !stream->write_queue_size()) {
-        idle_timer->once(idle_timeout);
+    if (idle_registered && !requests.size() && !server->_idle_wheel.armed(idle_entry) && !wbuf.size() && !stream->write_queue_size()) {
+        server->_idle_wheel.arm(idle_entry, idle_timeout);
     }
 }
 
 void ServerConnection::on_write (const ErrorCode& err, const WriteRequestSP&) {
+    ++writes_done;
     if (err) {
         panda_log_notice("write error: " << err);
         close(err);
         return;
     }
     
+    while (latency_marks.size() && latency_marks.front().first <= writes_done) {
+        record_latency(latency_marks.front().second);
+        latency_marks.pop_front();
+    }
+
     //active idle timer when the last write request from the last response has been written
     check_if_idle();
 }
 
 void ServerConnection::on_shutdown(const ErrorCode& err, const ShutdownRequestSP&) {
     if (err) panda_log_notice("shutdown error: " << err);
-    if (idle_timer) idle_timer->stop();
+    idle_remove();
     stream->event_listener(nullptr); // there should be no more events anyway
     server->remove(this);
 }
@@ -289,7 +440,7 @@ void ServerConnection::drop_requests (const ErrorCode& err) {
         auto req = requests.front();
         // remove request from pool first, because no one listen for responses,
         // we need request/response objects to completely ignore any calls to respond(), send_chunk(), end_chunk()
-        cleanup_request();
+        cleanup_request(err);
         if (!req->is_done()) {
             if (req->_partial) req->partial_event(req, err);
             else               server->error_event(req, err);
@@ -306,10 +457,12 @@ void ServerConnection::do_close (const ErrorCode& err, bool soft) {
     ServerSP hold_srv = server; (void)hold_srv;
 
     if (soft) {
+        flush();
         stream->shutdown();
         stream->disconnect();
     } else {
-        if (idle_timer) idle_timer->stop();
+        wbuf.clear();
+        idle_remove();
         stream->event_listener(nullptr);
         stream->reset();
     }
@@ -321,6 +474,19 @@ void ServerConnection::do_close (const ErrorCode& err, bool soft) {
     }
 }
 
+// HTTP/2 is not supported. Instead of answering 400 to the preface, which h2 clients can't read, reply in HTTP/2 framing:
+// empty SETTINGS (server preface) and GOAWAY with HTTP_1_1_REQUIRED, so that client retries over HTTP/1.1.
+void ServerConnection::refuse_http2 () {
+    static const char frames[] = {
+        0, 0, 0, 0x04, 0, 0, 0, 0, 0,                         // SETTINGS, no parameters
+        0, 0, 8, 0x07, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0d // GOAWAY, last stream 0, HTTP_1_1_REQUIRED
+    };
+    panda_log_notice("HTTP/2 connection preface received, refusing");
+    stream->read_ignore();
+    write(string(frames, sizeof(frames)));
+    shutdown({});
+}
+
 void ServerConnection::graceful_stop () {
     // immediately shutdown connection if we are idle
     if (!requests.size()) {
@@ -338,12 +504,10 @@ StreamSP ServerConnection::upgrade(const ServerRequest* req) {
     ServerConnectionSP hold = this; (void)hold;
     ServerSP hold_srv = server; (void)hold_srv;
 
+    flush(); // upgrade response might be still corked
     stream->event_listener(nullptr);
 
-    if (idle_timer) {
-        idle_timer->stop();
-        idle_timer = nullptr;
-    }
+    idle_remove();
 
     cleanup_request();
 
@@ -1,6 +1,9 @@
 #pragma once
+#include <chrono>
 #include <cstdint>
 #include <deque>
+#include <vector>
+#include "TimerWheel.h"
 #include "ServerRequest.h"
 #include "panda/error.h"
 #include "panda/refcnt.h"
@@ -12,7 +15,7 @@ namespace panda { namespace unievent { namespace http {
 
 struct Server;
 
-struct ServerConnection : Refcnt, private IStreamSelfListener, private protocol::http::RequestParser::IFactory {
+struct ServerConnection : Refcnt, private IStreamSelfListener, private protocol::http::RequestParser::IFactory, private TimerWheel::IListener {
     struct IFactory {
         virtual ServerRequestSP new_request (ServerConnection*) = 0;
     };
@@ -49,12 +52,23 @@ struct ServerConnection : Refcnt, private IStreamSelfListener, private protocol:
     const iptr<T>& user_data() const { return dynamic_pointer_cast<T>(stream->user_data); }
 
 private:
-    friend ServerRequest; friend ServerResponse;
+    friend ServerRequest; friend ServerResponse; friend Server;
 
     enum class State { Running, Closing, ShuttingDown };
 
     using RequestParser = protocol::http::RequestParser;
     using Requests      = std::deque<ServerRequestSP>;
+    using IdleEntry     = TimerWheel::Handle;
+    using WriteBuffer   = std::vector<string>;
+    using LatencyMarks  = std::deque<std::pair<uint64_t, std::chrono::steady_clock::time_point>>; // write number -> request start
+
+    // while corked, writes are accumulated in wbuf and are sent with one write request (writev) when the outermost cork is released
+    struct Cork {
+        Cork (ServerConnection* c) : c(c) { ++c->corked; }
+        ~Cork () { if (!--c->corked) c->flush(); }
+    private:
+        ServerConnection* c;
+    };
 
     Server*       server;
     uint64_t      _id;
@@ -63,12 +77,22 @@ private:
     RequestParser parser;
     Requests      requests;
     uint64_t      requests_processed = 0;
+    uint64_t      requests_received  = 0;
     uint32_t      idle_timeout;
     uint64_t      max_keepalive_requests;
-    TimerSP       idle_timer;
+    IdleEntry     idle_entry;               // in server's idle wheel, valid if idle_registered
+    bool          idle_registered = false;
     bool          closing  = false;
     bool          stopping = false;
+    bool          preface_checked = false; // first bytes are not an HTTP/2 preface
+    string        preface_buf;             // start of the first request while it still might be a preface
     uint64_t      _establish_time;
+    size_t        _slot = 0; // position in server's connection list
+    WriteBuffer   wbuf;      // reused for every write, keeps its capacity
+    uint32_t      corked = 0;
+    uint64_t      writes_sent = 0;
+    uint64_t      writes_done = 0;
+    LatencyMarks  latency_marks; // answered requests waiting for the write with the end of their response to complete
 
     protocol::http::RequestSP new_request () override;
 
@@ -78,20 +102,43 @@ private:
     void on_shutdown  (const ErrorCode&, const ShutdownRequestSP&) override;
     void on_eof       () override;
 
+    void on_wheel_timeout () override;
+
     void request_error(const ServerRequestSP&, const ErrorCode& err);
 
     void respond            (const ServerRequestSP&, const ServerResponseSP&);
     void write_next_response();
+    bool write_frozen       (const ServerRequestSP&, const ServerResponseSP&);
     void send_continue      (const ServerRequestSP&);
     void send_chunk         (const ServerResponseSP&, const string& chunk);
     void send_final_chunk   (const ServerResponseSP&, const string& chunk);
+    void write_chunk        (const ServerResponseSP&, const string& chunk);
     void finish_request     ();
-    void cleanup_request    ();
+    void cleanup_request    (const ErrorCode& = {});
+    void start_span         (const ServerRequestSP&);
     void drop_requests      (const ErrorCode&);
     void check_if_idle      ();
 
+    template <class It>
+    void write (It begin, It end) {
+        wbuf.insert(wbuf.end(), begin, end);
+        if (!corked) flush();
+    }
+
+    void write (const string& buf) {
+        wbuf.push_back(buf);
+        if (!corked) flush();
+    }
+
+    void flush ();
+    void record_latency (std::chrono::steady_clock::time_point request_start);
+    void idle_disarm        ();
+    void idle_remove        ();
+
     void do_close(const ErrorCode&, bool soft);
 
+    void refuse_http2 ();
+
     StreamSP upgrade(const ServerRequest*);
 
     ServerResponseSP default_error_response(int code);
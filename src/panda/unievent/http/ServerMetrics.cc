@@ -0,0 +1,108 @@
+#include "ServerMetrics.h"
+#include <sstream>
+#include <algorithm>
+
+namespace panda { namespace unievent { namespace http {
+
+ServerMetrics::Snapshot ServerMetrics::snapshot () const {
+    Snapshot ret;
+    ret.accepted        = accepted.load();
+    ret.active          = active.load();
+    ret.requests        = requests.load();
+    ret.bytes_in        = bytes_in.load();
+    ret.bytes_out       = bytes_out.load();
+    ret.parse_errors    = parse_errors.load();
+    ret.responses_4xx   = responses_4xx.load();
+    ret.responses_5xx   = responses_5xx.load();
+    ret.keepalive_reuse = keepalive_reuse.load();
+    ret.pipelined       = pipelined.load();
+    ret.pipeline_depth  = pipeline_depth.load();
+    ret.latency.resize(Histogram::BUCKETS);
+    for (size_t i = 0; i < Histogram::BUCKETS; ++i) ret.latency[i] = latency._counts[i].load();
+    ret.latency_sum = latency._sum.load();
+    return ret;
+}
+
+ServerMetrics::Snapshot& ServerMetrics::Snapshot::operator+= (const Snapshot& oth) {
+    accepted        += oth.accepted;
+    active          += oth.active;
+    requests        += oth.requests;
+    bytes_in        += oth.bytes_in;
+    bytes_out       += oth.bytes_out;
+    parse_errors    += oth.parse_errors;
+    responses_4xx   += oth.responses_4xx;
+    responses_5xx   += oth.responses_5xx;
+    keepalive_reuse += oth.keepalive_reuse;
+    pipelined       += oth.pipelined;
+    pipeline_depth   = std::max(pipeline_depth, oth.pipeline_depth);
+    if (latency.size() < oth.latency.size()) latency.resize(oth.latency.size());
+    for (size_t i = 0; i < oth.latency.size(); ++i) latency[i] += oth.latency[i];
+    latency_sum += oth.latency_sum;
+    return *this;
+}
+
+uint64_t ServerMetrics::Snapshot::latency_count () const {
+    uint64_t ret = 0;
+    for (auto cnt : latency) ret += cnt;
+    return ret;
+}
+
+uint64_t ServerMetrics::Snapshot::latency_percentile (double p) const {
+    auto total = latency_count();
+    if (!total) return 0;
+    uint64_t target = std::max<uint64_t>(1, uint64_t(total * p / 100 + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < latency.size(); ++i) {
+        seen += latency[i];
+        if (seen >= target) return Histogram::value(i);
+    }
+    return 0;
+}
+
+static void metric (std::ostream& os, const string& prefix, const char* name, const char* type, const char* help) {
+    os << "# HELP " << prefix << "_" << name << " " << help << "\n";
+    os << "# TYPE " << prefix << "_" << name << " " << type << "\n";
+}
+
+static void metric (std::ostream& os, const string& prefix, const char* name, const char* type, const char* help, uint64_t val) {
+    metric(os, prefix, name, type, help);
+    os << prefix << "_" << name << " " << val << "\n";
+}
+
+string ServerMetrics::Snapshot::to_prometheus (const string& prefix) const {
+    static const double bounds[] = {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10}; // [s]
+
+    std::ostringstream os;
+    metric(os, prefix, "connections_accepted_total", "counter", "Connections accepted.", accepted);
+    metric(os, prefix, "connections_active", "gauge", "Connections open.", active);
+    metric(os, prefix, "requests_total", "counter", "Requests fully received.", requests);
+    metric(os, prefix, "received_bytes_total", "counter", "Bytes read from connections.", bytes_in);
+    metric(os, prefix, "sent_bytes_total", "counter", "Bytes written to connections.", bytes_out);
+    metric(os, prefix, "parse_errors_total", "counter", "Malformed requests.", parse_errors);
+
+    metric(os, prefix, "responses_total", "counter", "Error responses by status class.");
+    os << prefix << "_responses_total{class=\"4xx\"} " << responses_4xx << "\n";
+    os << prefix << "_responses_total{class=\"5xx\"} " << responses_5xx << "\n";
+
+    metric(os, prefix, "keepalive_requests_total", "counter", "Requests received on reused keep-alive connections.", keepalive_reuse);
+    metric(os, prefix, "pipelined_requests_total", "counter", "Requests received before previous ones on the connection were answered.", pipelined);
+    metric(os, prefix, "pipeline_depth_max", "gauge", "Max number of requests queued on one connection.", pipeline_depth);
+
+    metric(os, prefix, "request_duration_seconds", "histogram", "Time from first byte of request till last byte of response written.");
+    uint64_t cumulative = 0;
+    size_t   i = 0;
+    for (auto bound : bounds) {
+        auto bound_us = uint64_t(bound * 1000000);
+        for (; i < latency.size() && Histogram::value(i) <= bound_us; ++i) cumulative += latency[i];
+        os << prefix << "_request_duration_seconds_bucket{le=\"" << bound << "\"} " << cumulative << "\n";
+    }
+    auto count = latency_count();
+    os << prefix << "_request_duration_seconds_bucket{le=\"+Inf\"} " << count << "\n";
+    os << prefix << "_request_duration_seconds_sum " << (latency_sum / 1e6) << "\n";
+    os << prefix << "_request_duration_seconds_count " << count << "\n";
+
+    auto str = os.str();
+    return string(str.data(), str.size());
+}
+
+}}}
@@ -0,0 +1,96 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <panda/string.h>
+#include "LatencyHistogram.h"
+
+namespace panda { namespace unievent { namespace http {
+
+// Counters of a server. They are written only by server's loop thread with relaxed atomic loads/stores (no locked instructions,
+// no contention), so can be read from any thread at any time. Snapshots of several servers (e.g. MultiServer's workers) are summed up.
+struct ServerMetrics {
+    // single writer counter
+    struct Counter {
+        Counter () : _val(0) {}
+        void     add  (uint64_t v) { _val.store(_val.load(std::memory_order_relaxed) + v, std::memory_order_relaxed); }
+        void     set  (uint64_t v) { _val.store(v, std::memory_order_relaxed); }
+        uint64_t load () const     { return _val.load(std::memory_order_relaxed); }
+        void operator++ () { add(1); }
+    private:
+        std::atomic<uint64_t> _val;
+    };
+
+    // buckets of LatencyHistogram, all preallocated
+    struct Histogram {
+        static constexpr const unsigned SUB     = LatencyHistogram::SUB;
+        static constexpr const unsigned BUCKETS = SUB * 2 + SUB * 58;
+
+        static size_t   index (uint64_t v) { return LatencyHistogram::index(v); }
+        static uint64_t value (size_t i)   { return LatencyHistogram::value(i); }
+
+        Histogram () : _counts(new Counter[BUCKETS]) {}
+
+        void add (uint64_t v) {
+            ++_counts[index(v)];
+            _sum.add(v);
+        }
+
+    private:
+        friend ServerMetrics;
+        std::unique_ptr<Counter[]> _counts;
+        Counter                    _sum;
+    };
+
+    struct Snapshot {
+        uint64_t accepted        = 0; // connections
+        uint64_t active          = 0; // connections open now
+        uint64_t requests        = 0; // fully received
+        uint64_t bytes_in        = 0;
+        uint64_t bytes_out       = 0;
+        uint64_t parse_errors    = 0;
+        uint64_t responses_4xx   = 0;
+        uint64_t responses_5xx   = 0;
+        uint64_t keepalive_reuse = 0; // requests which were not the first on their connection
+        uint64_t pipelined       = 0; // requests received while previous ones on the same connection were not answered yet
+        uint64_t pipeline_depth  = 0; // max number of requests queued on one connection ever seen
+        std::vector<uint64_t> latency; // counts per Histogram bucket: from first byte of request till last byte of response written
+        uint64_t latency_sum = 0;      // [us]
+
+        Snapshot& operator+= (const Snapshot&);
+
+        uint64_t latency_count      () const;
+        uint64_t latency_percentile (double p) const; // [us]
+
+        // Prometheus text exposition format (version 0.0.4)
+        string to_prometheus (const string& prefix = "unievent_http_server") const;
+    };
+
+    Counter   accepted;
+    Counter   active;
+    Counter   requests;
+    Counter   bytes_in;
+    Counter   bytes_out;
+    Counter   parse_errors;
+    Counter   responses_4xx;
+    Counter   responses_5xx;
+    Counter   keepalive_reuse;
+    Counter   pipelined;
+    Counter   pipeline_depth;
+    Histogram latency;
+
+    Snapshot snapshot () const;
+
+    void response (int code) {
+        if      (code >= 500) ++responses_5xx;
+        else if (code >= 400) ++responses_4xx;
+    }
+
+    void queued (size_t depth) {
+        if (depth > 1) ++pipelined;
+        if (depth > pipeline_depth.load()) pipeline_depth.set(depth);
+    }
+};
+
+}}}
@@ -1,11 +1,13 @@
 #pragma once
 #include "msg.h"
 #include "ServerResponse.h"
+#include "Tracer.h"
 #include <panda/error.h>
 #include <panda/excepted.h>
 #include <panda/net/sockaddr.h>
 #include <panda/unievent/forward.h>
 #include <panda/CallbackDispatcher.h>
+#include <chrono>
 
 namespace panda { namespace unievent { namespace http {
 
@@ -68,6 +70,9 @@ private:
     bool              _finish_on_receive = false;
     bool              _is_done           = false;
     bool              _is_secure;
+    std::chrono::steady_clock::time_point _received_at; // first byte
+    uint64_t          _trace_start       = 0; // first byte, unix time [ns], only when tracing is enabled
+    TraceSpanPtr      _span;
 };
 
 }}}
@@ -1,5 +1,6 @@
 #pragma once
 #include "msg.h"
+#include <vector>
 
 namespace panda { namespace unievent { namespace http {
 
@@ -7,6 +8,7 @@ struct ServerRequest;
 
 struct ServerResponse : protocol::http::Response {
     struct Builder;
+    struct Frozen;
 
     ServerResponse () : _request(), _completed() {}
 
@@ -19,16 +21,31 @@ struct ServerResponse : protocol::http::Response {
 
     bool completed () const { return _completed; }
 
+    // Serializes status line, headers and body once, so that the same response object can be given to any number of requests
+    // without building it every time. Only Date and Connection headers are generated per request.
+    // Response must not be chunked or compressed. Any changes made to it after freezing are ignored.
+    // As strings are not thread-safe, frozen response can only be shared within one loop (i.e. make one per MultiServer worker).
+    void freeze ();
+    bool frozen () const { return _frozen; }
+
 private:
     friend ServerRequest;
     friend struct ServerConnection;
 
     ServerRequest* _request;
     bool           _completed;
+    iptr<Frozen>   _frozen;
 
+    iptr<ServerResponse> instance () const; // light per-request response which refers to the same serialized data
 };
 using ServerResponseSP = iptr<ServerResponse>;
 
+struct ServerResponse::Frozen : Refcnt {
+    string              head[2];      // status line and headers up to the Date value, for HTTP/1.0 and HTTP/1.1
+    std::vector<string> body;
+    bool                keep_alive;   // false if user's response says "Connection: close"
+};
+
 struct ServerResponse::Builder : protocol::http::Response::BuilderImpl<Builder, ServerResponseSP> {
     Builder () : BuilderImpl(new ServerResponse()) {}
 };
@@ -0,0 +1,71 @@
+#include "SslConfig.h"
+#include "Client.h"
+#include "error.h"
+#include <mutex>
+#include <vector>
+#include <openssl/ssl.h>
+
+namespace panda { namespace unievent { namespace http {
+
+static void fail (const char* what, const string& arg) {
+    string msg(what);
+    msg += arg;
+    throw HttpError(msg);
+}
+
+static SslContext build (const SslConfig& cfg) {
+    auto ret = SslContext::attach(SSL_CTX_new(TLS_client_method()));
+    SSL_CTX* ctx = ret;
+
+    if (cfg.verify) {
+        bool ok = cfg.ca_file || cfg.ca_path
+            ? SSL_CTX_load_verify_locations(ctx, cfg.ca_file ? cfg.ca_file.c_str() : nullptr, cfg.ca_path ? cfg.ca_path.c_str() : nullptr)
+            : SSL_CTX_set_default_verify_paths(ctx);
+        if (!ok) throw HttpError("can not set ssl certificate verify paths");
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+    }
+
+    if (cfg.cert_file) {
+        if (!SSL_CTX_use_certificate_chain_file(ctx, cfg.cert_file.c_str())) fail("can not load ssl certificate ", cfg.cert_file);
+        auto key = cfg.key_file ? cfg.key_file : cfg.cert_file;
+        if (!SSL_CTX_use_PrivateKey_file(ctx, key.c_str(), SSL_FILETYPE_PEM)) fail("can not load ssl private key ", key);
+        if (!SSL_CTX_check_private_key(ctx)) fail("ssl private key does not match certificate ", cfg.cert_file);
+    }
+
+    if (cfg.ciphers && !SSL_CTX_set_cipher_list(ctx, cfg.ciphers.c_str())) fail("invalid ssl cipher list ", cfg.ciphers);
+    if (cfg.min_version && !SSL_CTX_set_min_proto_version(ctx, cfg.min_version)) throw HttpError("invalid ssl min version");
+
+    Client::setup_ssl_context(ctx); // while nobody else sees it
+    return ret;
+}
+
+// strings of registered configs are compared from every thread, they must not share buffers with any of them
+static SslConfig isolate (const SslConfig& src) {
+    SslConfig ret = src;
+    for (auto s : {&ret.ca_file, &ret.ca_path, &ret.cert_file, &ret.key_file, &ret.ciphers}) *s = string(s->data(), s->length());
+    return ret;
+}
+
+using Contexts = std::vector<std::pair<SslConfig, SslContext>>; // a handful of distinct configs is expected
+
+// the process-wide registry is locked only when a thread meets a config for the first time, then it's found in the thread's own list
+SslContext ssl_context (const SslConfig& cfg) {
+    static thread_local Contexts local;
+    for (auto& row : local) if (row.first == cfg) return row.second;
+
+    static std::mutex mutex;
+    static Contexts   contexts;
+    SslContext ret;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& row : contexts) if (row.first == cfg) { ret = row.second; break; }
+        if (!ret) {
+            ret = build(cfg);
+            contexts.emplace_back(isolate(cfg), ret);
+        }
+    }
+    local.emplace_back(isolate(cfg), ret);
+    return ret;
+}
+
+}}}
@@ -0,0 +1,30 @@
+#pragma once
+#include <panda/string.h>
+#include <panda/unievent/SslContext.h>
+
+namespace panda { namespace unievent { namespace http {
+
+// Description of client SSL context. Contexts are built by ssl_context() once per distinct config for the whole process and shared
+// by all threads (SSL_CTX is thread-safe once configured), so requests with equal configs get the same context and may reuse
+// each other's pool connections, while every request with its own SslContext object gets its own connections.
+struct SslConfig {
+    bool   verify = true; // verify server certificate against ca_file/ca_path, or against system trust store if both are empty
+    string ca_file;
+    string ca_path;
+    string cert_file;     // client certificate chain (PEM), if server requires one
+    string key_file;
+    string ciphers;       // OpenSSL cipher list, library default if empty
+    int    min_version = 0; // e.g. TLS1_2_VERSION, 0 = library default
+
+    bool operator== (const SslConfig& o) const {
+        return verify == o.verify && ca_file == o.ca_file && ca_path == o.ca_path && cert_file == o.cert_file && key_file == o.key_file &&
+               ciphers == o.ciphers && min_version == o.min_version;
+    }
+    bool operator!= (const SslConfig& o) const { return !operator==(o); }
+};
+
+// returns process-wide context for the config, building it on first use. Contexts already used by the calling thread are found without
+// locking. Throws HttpError if certificates can't be loaded.
+SslContext ssl_context (const SslConfig&);
+
+}}}
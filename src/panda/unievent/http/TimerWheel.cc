@@ -0,0 +1,108 @@
+#include "TimerWheel.h"
+#include <cassert>
+
+namespace panda { namespace unievent { namespace http {
+
+TimerWheel::TimerWheel (const LoopSP& loop, uint32_t tick) : _tick(tick ? tick : 1), _slots(SLOTS) {
+    _timer = new Timer(loop);
+    _timer->event.add([this](auto&){ on_tick(); });
+}
+
+TimerWheel::~TimerWheel () {
+    _timer->stop();
+}
+
+void TimerWheel::tick (uint32_t val) {
+    if (!val) val = 1;
+    if (val == _tick) return;
+    _tick = val;
+    _timer->stop();
+    if (!_narmed) return;
+
+    List armed;
+    for (auto& slot : _slots) armed.splice(armed.end(), slot);
+    _last = _timer->loop()->now() / _tick;
+    schedule();
+    while (!armed.empty()) {
+        auto h = armed.begin();
+        auto slot = slot_for(h->deadline);
+        _slots[slot].splice(_slots[slot].end(), armed, h);
+        h->slot = slot;
+    }
+}
+
+// until the next tick boundary rather than a whole tick from now, otherwise slots would be processed up to a tick later than they end
+void TimerWheel::schedule () {
+    auto now = _timer->loop()->now();
+    _timer->once(_tick - now % _tick);
+}
+
+size_t TimerWheel::slot_for (uint64_t deadline) const {
+    auto t = (deadline + _tick - 1) / _tick; // round up, so that it never fires earlier
+    if (t <= _last) t = _last + 1;
+    return t & (SLOTS - 1);
+}
+
+TimerWheel::Handle TimerWheel::add (IListener* listener) {
+    ++_size;
+    return _parked.insert(_parked.end(), Entry{listener, 0, PARKED});
+}
+
+void TimerWheel::remove (Handle h) {
+    if (armed(h)) --_narmed;
+    list(h->slot).erase(h);
+    --_size;
+    if (!_narmed) _timer->stop();
+}
+
+void TimerWheel::arm (Handle h, uint64_t timeout) {
+    auto now = _timer->loop()->now();
+    if (!_timer->active()) {
+        _last = now / _tick;
+        schedule();
+    }
+
+    h->deadline = now + timeout;
+    auto slot = slot_for(h->deadline);
+
+    if (!armed(h)) ++_narmed;
+    _slots[slot].splice(_slots[slot].end(), list(h->slot), h);
+    h->slot = slot;
+}
+
+void TimerWheel::disarm (Handle h) {
+    if (!armed(h)) return;
+    --_narmed; // timer is left to fire once more, as entries are usually re-armed soon
+    _parked.splice(_parked.end(), list(h->slot), h);
+    h->slot = PARKED;
+}
+
+void TimerWheel::on_tick () {
+    auto now = _timer->loop()->now();
+    auto cur = now / _tick;
+
+    // if we are late for more than a whole round, every slot is checked once
+    for (size_t n = 0; _last < cur && n < SLOTS; ++n) {
+        auto& slot = _slots[++_last & (SLOTS - 1)];
+        for (auto it = slot.begin(); it != slot.end();) {
+            auto h = it++;
+            if (h->deadline > now) continue; // next rounds
+            --_narmed;
+            _firing.splice(_firing.end(), slot, h);
+            h->slot = FIRING;
+        }
+    }
+    _last = cur;
+
+    // listeners may remove or re-arm any entries, including ones from _firing
+    while (!_firing.empty()) {
+        auto h = _firing.begin();
+        _parked.splice(_parked.end(), _firing, h);
+        h->slot = PARKED;
+        h->listener->on_wheel_timeout();
+    }
+
+    if (_narmed && !_timer->active()) schedule();
+}
+
+}}}
@@ -0,0 +1,72 @@
+#pragma once
+#include <list>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <panda/unievent/Timer.h>
+
+namespace panda { namespace unievent { namespace http {
+
+// Hashed timer wheel driven by a single loop timer. Intended for large amounts of timeouts which are re-armed much more often than they fire,
+// like idle timeouts of keep-alive connections. All operations except add() are O(1) and do not allocate.
+// A timeout never fires earlier than requested, but may fire up to one tick later (plus loop latency): the timer fires on tick
+// boundaries of loop time, which slots are counted in.
+struct TimerWheel {
+    static constexpr const uint32_t DEFAULT_TICK = 1000; // [ms]
+    static constexpr const size_t   SLOTS        = 256;  // must be power of 2
+
+    struct IListener {
+        virtual void on_wheel_timeout () = 0;
+    };
+
+private:
+    struct Entry {
+        IListener* listener;
+        uint64_t   deadline;
+        size_t     slot;
+    };
+    using List = std::list<Entry>;
+
+public:
+    using Handle = List::iterator;
+
+    TimerWheel (const LoopSP& loop, uint32_t tick = DEFAULT_TICK);
+    ~TimerWheel ();
+
+    uint32_t tick () const { return _tick; }
+    void     tick (uint32_t val); // armed entries are moved to the slots of the new tick, keeping their deadlines
+
+    size_t size   () const { return _size; }
+    size_t narmed () const { return _narmed; }
+
+    Handle add    (IListener*); // registers disarmed entry
+    void   remove (Handle);
+    void   arm    (Handle, uint64_t timeout); // (re)arms entry to fire after timeout [ms]
+    void   disarm (Handle);
+
+    bool armed (Handle h) const { return h->slot < SLOTS; }
+
+private:
+    static constexpr const size_t PARKED = SLOTS;
+    static constexpr const size_t FIRING = SLOTS + 1;
+
+    TimerSP           _timer;
+    uint32_t          _tick;
+    std::vector<List> _slots;
+    List              _parked;        // registered but not armed
+    List              _firing;        // expired and waiting for callback
+    uint64_t          _last   = 0;    // last processed tick
+    size_t            _size   = 0;
+    size_t            _narmed = 0;
+
+    List& list (size_t slot) { return slot < SLOTS ? _slots[slot] : slot == PARKED ? _parked : _firing; }
+
+    size_t slot_for (uint64_t deadline) const;
+    void   schedule ();
+    void   on_tick  ();
+
+    TimerWheel (const TimerWheel&) = delete;
+    TimerWheel& operator= (const TimerWheel&) = delete;
+};
+
+}}}
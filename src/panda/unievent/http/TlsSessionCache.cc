@@ -0,0 +1,55 @@
+#include "TlsSessionCache.h"
+#include <cstdio>
+
+namespace panda { namespace unievent { namespace http {
+
+string TlsSessionCache::key (const string& host, uint16_t port, const SSL_CTX* ctx) {
+    char buf[64];
+    auto len = snprintf(buf, sizeof(buf), ":%u:%p", unsigned(port), static_cast<const void*>(ctx));
+    string ret = host;
+    ret += string(buf, len);
+    return ret;
+}
+
+void TlsSessionCache::max_count (size_t value) {
+    _max_count = value;
+    while (_lru.size() > _max_count) erase(std::prev(_lru.end()));
+}
+
+void TlsSessionCache::clear () {
+    for (auto& e : _lru) SSL_SESSION_free(e.session);
+    _lru.clear();
+    _index.clear();
+}
+
+void TlsSessionCache::store (const string& key, SSL_SESSION* session) {
+    if (!_max_count) return SSL_SESSION_free(session);
+
+    auto it = _index.find(key);
+    if (it != _index.end()) erase(it->second);
+
+    _lru.push_front({key, session});
+    _index.emplace(key, _lru.begin());
+    max_count(_max_count);
+}
+
+SSL_SESSION* TlsSessionCache::take (const string& key) {
+    auto it = _index.find(key);
+    if (it == _index.end()) return nullptr;
+
+    auto session = it->second->session;
+    if (SSL_SESSION_get_protocol_version(session) >= TLS1_3_VERSION) { // single use, reference goes to caller
+        _lru.erase(it->second);
+        _index.erase(it);
+    }
+    else SSL_SESSION_up_ref(session);
+    return session;
+}
+
+void TlsSessionCache::erase (Lru::iterator it) {
+    SSL_SESSION_free(it->session);
+    _index.erase(it->key);
+    _lru.erase(it);
+}
+
+}}}
@@ -0,0 +1,60 @@
+#pragma once
+#include <list>
+#include <cstdint>
+#include <unordered_map>
+#include <panda/string.h>
+#include <openssl/ssl.h>
+
+namespace panda { namespace unievent { namespace http {
+
+struct Client;
+
+// TLS sessions (tickets) of pool's client connections, offered on reconnect to the same host:port with the same SSL_CTX, so that
+// the server can resume the session instead of doing a full handshake. One session per key is kept, the number of keys is bounded
+// by LRU. TLS 1.3 sessions are handed out only once, as servers may reject reused tickets; a new one arrives on every connection.
+struct TlsSessionCache {
+    static constexpr const size_t DEFAULT_MAX_COUNT = 1000;
+
+    struct Stats {
+        uint64_t hits   = 0; // resumed handshakes
+        uint64_t misses = 0; // full handshakes
+    };
+
+    TlsSessionCache (size_t max_count = DEFAULT_MAX_COUNT) : _max_count(max_count) {}
+
+    ~TlsSessionCache () { clear(); }
+
+    size_t count () const { return _lru.size(); }
+
+    size_t max_count () const { return _max_count; }
+    void   max_count (size_t);
+
+    const Stats& stats () const { return _stats; }
+
+    void clear ();
+
+private:
+    friend Client;
+
+    struct Entry {
+        string       key;
+        SSL_SESSION* session;
+    };
+    using Lru = std::list<Entry>;
+
+    size_t                                    _max_count;
+    Lru                                       _lru; // most recently stored first
+    std::unordered_map<string, Lru::iterator> _index;
+    Stats                                     _stats;
+
+    static string key (const string& host, uint16_t port, const SSL_CTX*);
+
+    void         store (const string& key, SSL_SESSION*); // takes ownership
+    SSL_SESSION* take  (const string& key);               // returns a new reference or nullptr
+    void         erase (Lru::iterator);
+
+    TlsSessionCache (const TlsSessionCache&) = delete;
+    TlsSessionCache& operator= (const TlsSessionCache&) = delete;
+};
+
+}}}
@@ -0,0 +1,305 @@
+#include "Tracer.h"
+#include "error.h"
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <string>
+
+namespace panda { namespace unievent { namespace http {
+
+ITraceSink* Tracer::_sink        = nullptr;
+double      Tracer::_sample_rate = 1;
+thread_local const TraceContext* Tracer::_current = nullptr;
+
+static std::mt19937_64& rng () {
+    static thread_local std::mt19937_64 ret(std::random_device{}());
+    return ret;
+}
+
+template <size_t N>
+static void random_id (std::array<uint8_t, N>& id) {
+    do {
+        for (size_t i = 0; i < N; i += 8) {
+            auto r = rng()();
+            for (size_t j = i; j < N && j < i + 8; ++j, r >>= 8) id[j] = uint8_t(r);
+        }
+    } while (std::all_of(id.begin(), id.end(), [](uint8_t b) { return !b; }));
+}
+
+template <size_t N>
+static bool parse_hex (const char* s, std::array<uint8_t, N>& id) {
+    for (size_t i = 0; i < N; ++i) {
+        uint8_t byte = 0;
+        for (int j = 0; j < 2; ++j) {
+            char c = s[i * 2 + j];
+            byte <<= 4;
+            if      (c >= '0' && c <= '9') byte |= c - '0';
+            else if (c >= 'a' && c <= 'f') byte |= c - 'a' + 10;
+            else return false;
+        }
+        id[i] = byte;
+    }
+    return true;
+}
+
+template <size_t N>
+static void append_hex (string& out, const std::array<uint8_t, N>& id) {
+    static const char digits[] = "0123456789abcdef";
+    for (auto b : id) {
+        out += digits[b >> 4];
+        out += digits[b & 15];
+    }
+}
+
+bool TraceContext::valid () const {
+    auto nonzero = [](uint8_t b) { return b != 0; };
+    return std::any_of(trace_id.begin(), trace_id.end(), nonzero) && std::any_of(span_id.begin(), span_id.end(), nonzero);
+}
+
+// version-traceid-parentid-flags, e.g. 00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01
+TraceContext TraceContext::parse (const string& s) {
+    TraceContext ret;
+    if (s.length() < 55 || s[2] != '-' || s[35] != '-' || s[52] != '-' || (s.length() > 55 && s[55] != '-')) return {};
+    if (s[0] == 'f' && s[1] == 'f') return {};
+    std::array<uint8_t, 1> version, flags;
+    if (!parse_hex(s.data(), version) || !parse_hex(s.data() + 3, ret.trace_id) || !parse_hex(s.data() + 36, ret.span_id) ||
+        !parse_hex(s.data() + 53, flags)) return {};
+    if (!ret.valid()) return {};
+    ret.sampled = flags[0] & 1;
+    return ret;
+}
+
+string TraceContext::traceparent () const {
+    string ret(55);
+    ret += "00-";
+    append_hex(ret, trace_id);
+    ret += '-';
+    append_hex(ret, span_id);
+    ret += sampled ? "-01" : "-00";
+    return ret;
+}
+
+void TraceSpan::event (const char* name) { events.push_back({name, Tracer::now()}); }
+
+void TraceSpan::request (const protocol::http::Request& req) {
+    using Method = protocol::http::Request::Method;
+    switch (req.method_raw()) {
+        case Method::Options : name = "OPTIONS"; break;
+        case Method::Get     : name = "GET";     break;
+        case Method::Head    : name = "HEAD";    break;
+        case Method::Post    : name = "POST";    break;
+        case Method::Put     : name = "PUT";     break;
+        case Method::Delete  : name = "DELETE";  break;
+        case Method::Trace   : name = "TRACE";   break;
+        default              : name = "HTTP";
+    }
+    attributes.emplace_back("http.request.method", name);
+    if (req.uri) attributes.emplace_back(kind == Kind::server ? "url.path" : "url.full", req.uri->to_string());
+}
+
+void Tracer::configure (ITraceSink* sink, double sample_rate) {
+    _sink        = sink;
+    _sample_rate = sample_rate;
+}
+
+uint64_t Tracer::now () {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+TraceSpanPtr Tracer::start (TraceSpan::Kind kind, const TraceContext* parent, uint64_t start_time) {
+    if (!enabled()) return {};
+    if (!parent) parent = _current;
+    bool inherited = parent && parent->valid();
+    bool sampled   = inherited ? parent->sampled : std::uniform_real_distribution<double>()(rng()) < _sample_rate;
+    if (!sampled) return {};
+
+    TraceSpanPtr ret(new TraceSpan());
+    ret->kind  = kind;
+    ret->start = start_time;
+    if (inherited) {
+        ret->parent = *parent;
+        ret->context.trace_id = parent->trace_id;
+    }
+    else random_id(ret->context.trace_id);
+    random_id(ret->context.span_id);
+    ret->context.sampled = true;
+    return ret;
+}
+
+void Tracer::finish (TraceSpanPtr& span) {
+    if (!span) return;
+    span->end = now();
+    if (_sink) _sink->export_span(*span);
+    span.reset();
+}
+
+static ErrorCode isolate (const ErrorCode& err) {
+    if (!err) return {};
+    auto next = err.next();
+    return next ? ErrorCode(err.code(), isolate(next)) : ErrorCode(err.code());
+}
+
+// the copy shares nothing with the thread which has finished the span, as take() is called from another one
+static TraceSpan isolate (const TraceSpan& src) {
+    TraceSpan ret;
+    ret.context     = src.context;
+    ret.parent      = src.parent;
+    ret.kind        = src.kind;
+    ret.name        = string(src.name.data(), src.name.length());
+    ret.start       = src.start;
+    ret.end         = src.end;
+    ret.events      = src.events;
+    ret.status_code = src.status_code;
+    ret.error       = isolate(src.error);
+    ret.attributes.reserve(src.attributes.size());
+    for (auto& a : src.attributes) ret.attributes.emplace_back(a.first, string(a.second.data(), a.second.length()));
+    return ret;
+}
+
+void MemoryTraceSink::export_span (const TraceSpan& span) {
+    auto copy = isolate(span);
+    std::lock_guard<std::mutex> lock(_mutex);
+    _spans.push_back(std::move(copy));
+}
+
+std::vector<TraceSpan> MemoryTraceSink::take () {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<TraceSpan> ret;
+    std::swap(ret, _spans);
+    return ret;
+}
+
+FileTraceSink::FileTraceSink (const string& path, const string& service_name, uint64_t flush_interval, size_t batch_size)
+    : _service_name(service_name.data(), service_name.length()), _flush_interval(flush_interval), _batch_size(batch_size)
+{
+    _file = fopen(path.c_str(), "a");
+    if (!_file) {
+        string msg("can not open trace file ");
+        msg += path;
+        throw HttpError(msg);
+    }
+    _writer = std::thread(&FileTraceSink::write_loop, this);
+}
+
+FileTraceSink::~FileTraceSink () {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _cv.notify_one();
+    _writer.join();
+    fclose(_file);
+}
+
+// disk is touched only by this thread, loop threads just append to the buffer
+void FileTraceSink::write_loop () {
+    std::string batch;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _cv.wait_for(lock, std::chrono::milliseconds(_flush_interval), [this]{ return _stopping || _pending.size() >= _batch_size; });
+        std::swap(batch, _pending);
+        bool stopping = _stopping;
+        lock.unlock();
+        if (batch.size()) {
+            fwrite(batch.data(), 1, batch.size(), _file);
+            fflush(_file);
+            batch.clear();
+        }
+        if (stopping) return;
+        lock.lock();
+    }
+}
+
+static void append_json_string (string& out, const string& s) {
+    out += '"';
+    for (auto c : s) {
+        switch (c) {
+            case '"'  : out += "\\\""; break;
+            case '\\' : out += "\\\\"; break;
+            case '\n' : out += "\\n";  break;
+            case '\r' : out += "\\r";  break;
+            case '\t' : out += "\\t";  break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                }
+                else out += c;
+        }
+    }
+    out += '"';
+}
+
+static void append_attribute (string& out, const char* key, const string& value) {
+    out += "{\"key\":\"";
+    out += key;
+    out += "\",\"value\":{\"stringValue\":";
+    append_json_string(out, value);
+    out += "}}";
+}
+
+void FileTraceSink::export_span (const TraceSpan& span) {
+    string out(1024);
+    out += "{\"resourceSpans\":[{\"resource\":{\"attributes\":[";
+    append_attribute(out, "service.name", _service_name);
+    out += "]},\"scopeSpans\":[{\"scope\":{\"name\":\"unievent-http\"},\"spans\":[{\"traceId\":\"";
+    append_hex(out, span.context.trace_id);
+    out += "\",\"spanId\":\"";
+    append_hex(out, span.context.span_id);
+    out += '"';
+    if (span.parent.valid()) {
+        out += ",\"parentSpanId\":\"";
+        append_hex(out, span.parent.span_id);
+        out += '"';
+    }
+    out += ",\"name\":";
+    append_json_string(out, span.name);
+    out += ",\"kind\":";
+    out += to_string(int(span.kind));
+    out += ",\"startTimeUnixNano\":\"";
+    out += to_string(span.start);
+    out += "\",\"endTimeUnixNano\":\"";
+    out += to_string(span.end);
+    out += "\",\"attributes\":[";
+    for (size_t i = 0; i < span.attributes.size(); ++i) {
+        if (i) out += ',';
+        append_attribute(out, span.attributes[i].first, span.attributes[i].second);
+    }
+    if (span.status_code) {
+        if (span.attributes.size()) out += ',';
+        out += "{\"key\":\"http.response.status_code\",\"value\":{\"intValue\":\"";
+        out += to_string(span.status_code);
+        out += "\"}}";
+    }
+    out += "],\"events\":[";
+    for (size_t i = 0; i < span.events.size(); ++i) {
+        if (i) out += ',';
+        out += "{\"timeUnixNano\":\"";
+        out += to_string(span.events[i].time);
+        out += "\",\"name\":\"";
+        out += span.events[i].name;
+        out += "\"}";
+    }
+    out += ']';
+    if (span.error || span.status_code >= 500) {
+        out += ",\"status\":{\"code\":2";
+        if (span.error) {
+            out += ",\"message\":";
+            auto msg = span.error.message();
+            append_json_string(out, string(msg.data(), msg.size()));
+        }
+        out += '}';
+    }
+    out += "}]}]}]}\n";
+
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending.append(out.data(), out.length());
+        full = _pending.size() >= _batch_size;
+    }
+    if (full) _cv.notify_one();
+}
+
+}}}
@@ -0,0 +1,156 @@
+#pragma once
+#include <array>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <condition_variable>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include "msg.h"
+#include <panda/error.h>
+#include <panda/string.h>
+
+namespace panda { namespace unievent { namespace http {
+
+// W3C trace context (https://www.w3.org/TR/trace-context/), carried by "traceparent" header
+struct TraceContext {
+    std::array<uint8_t, 16> trace_id = {};
+    std::array<uint8_t, 8>  span_id  = {};
+    bool                    sampled  = false;
+
+    bool valid () const;
+
+    static TraceContext parse (const string& traceparent); // invalid if malformed
+    string traceparent () const;
+};
+
+// Span of a server request (kind = server) or of a client request with all its retries and redirects (kind = client).
+// Events are lifecycle steps of the request, times are unix time [ns].
+struct TraceSpan {
+    enum class Kind { server = 2, client = 3 }; // as in OTLP
+
+    struct Event {
+        const char* name;
+        uint64_t    time;
+    };
+    using Attributes = std::vector<std::pair<const char*, string>>;
+
+    TraceContext       context;
+    TraceContext       parent; // invalid for root spans
+    Kind               kind  = Kind::server;
+    string             name;
+    uint64_t           start = 0;
+    uint64_t           end   = 0;
+    std::vector<Event> events;
+    Attributes         attributes;
+    int                status_code = 0; // of http response, 0 if there was none
+    ErrorCode          error;           // span status is error if set or if status code is 5xx
+
+    void event (const char* name);
+    void event (const char* name, uint64_t time) { events.push_back({name, time}); }
+
+    void request (const protocol::http::Request&); // span name and http attributes of the request
+};
+using TraceSpanPtr = std::unique_ptr<TraceSpan>;
+
+// Receives finished sampled spans, may be called from several threads (MultiServer, Pool per thread). It's called on the request's loop
+// thread, so it must not block. Strings and error of the span share non-atomic refcounted buffers with that thread, a sink must not keep
+// references to them: it serializes the span at once or stores a deep copy (see MemoryTraceSink).
+struct ITraceSink {
+    virtual void export_span (const TraceSpan&) = 0;
+    virtual ~ITraceSink () {}
+};
+
+// keeps spans in memory, mostly for tests and for exporting them by user's means
+struct MemoryTraceSink : ITraceSink {
+    void export_span (const TraceSpan&) override;
+
+    std::vector<TraceSpan> take (); // returns spans collected so far and forgets them
+
+private:
+    std::mutex             _mutex;
+    std::vector<TraceSpan> _spans;
+};
+
+// appends spans to a file as OTLP/JSON lines (one ExportTraceServiceRequest per line), which OpenTelemetry Collector reads
+// with its otlpjsonfile receiver. Spans are only buffered by export_span(), they are written by a background thread every
+// `flush_interval` or as soon as `batch_size` bytes are buffered, and on destruction.
+struct FileTraceSink : ITraceSink {
+    FileTraceSink (const string& path, const string& service_name = "unievent-http", uint64_t flush_interval = 1000 /*ms*/,
+                   size_t batch_size = 65536);
+    ~FileTraceSink ();
+
+    void export_span (const TraceSpan&) override;
+
+private:
+    std::mutex              _mutex;
+    std::condition_variable _cv;
+    std::string             _pending; // serialized spans waiting to be written
+    bool                    _stopping = false;
+    FILE*                   _file;
+    string                  _service_name; // not shared with anyone, read concurrently
+    uint64_t                _flush_interval;
+    size_t                  _batch_size;
+    std::thread             _writer;
+
+    void write_loop ();
+};
+
+// Server and client requests get spans only when tracing is configured with a sink. A request carrying a traceparent follows its
+// sampling decision, otherwise sample_rate of traces are recorded. Unsampled requests cost a pointer check per lifecycle step.
+// Configure before servers and pools start, the settings are global for all threads. Build with UNIEVENT_HTTP_TRACE=OFF to compile
+// tracing out.
+struct Tracer {
+    static void configure (ITraceSink* sink, double sample_rate = 1); // nullptr sink turns tracing off
+
+    #ifdef UNIEVENT_HTTP_NO_TRACE
+    static constexpr bool enabled () { return false; }
+    #else
+    static bool enabled () { return _sink; }
+    #endif
+
+    static uint64_t now (); // unix time [ns]
+
+    // new span if the trace is sampled, nullptr otherwise. Parent is the context of a span running in this thread (see Scope) if not given.
+    static TraceSpanPtr start (TraceSpan::Kind, const TraceContext* parent, uint64_t start_time);
+
+    // sets end time and exports span
+    static void finish (TraceSpanPtr&);
+
+    // context of the server request whose callbacks are running, client requests started from them become its children
+    static const TraceContext* current () { return _current; }
+
+    #ifdef UNIEVENT_HTTP_NO_TRACE
+    struct Scope {
+        Scope (const TraceSpanPtr&) {}
+    };
+    #else
+    // context is copied, as span may be finished while callbacks are still running (i.e. request is responded synchronously)
+    struct Scope {
+        Scope (const TraceSpanPtr& span) : _prev(_current) {
+            if (!span) return;
+            _context = span->context;
+            _current = &_context;
+        }
+        ~Scope () { _current = _prev; }
+    private:
+        const TraceContext* _prev;
+        TraceContext        _context;
+    };
+    #endif
+
+private:
+    static ITraceSink* _sink;
+    static double      _sample_rate;
+    static thread_local const TraceContext* _current;
+};
+
+#ifdef UNIEVENT_HTTP_NO_TRACE
+#  define UEHT_TRACE(span, name)
+#else
+#  define UEHT_TRACE(span, name) do { if (span) (span)->event(name); } while (0)
+#endif
+
+}}}
@@ -65,6 +65,30 @@ TEST("connect_timeout") {
     CHECK(err.contains(make_error_code(std::errc::timed_out)));
 }
 
+TEST("connect_timeout with connection racing") {
+    AsyncTest test(1000);
+
+    TClientSP client = new TClient(test.loop);
+    client->sa = test.get_blackhole_addr();
+
+    // there are no other addresses to race, so primary connection's timeout is reported
+    auto err = client->get_error(Request::Builder().uri("/").timeout(999999999).connect_timeout(20).connect_attempt_delay(5).build());
+    CHECK(err.contains(make_error_code(std::errc::timed_out)));
+}
+
+TEST("happy eyeballs fails when primary connection fails and there are no alternatives") {
+    AsyncTest test(1000, {"result"});
+    auto srv = make_server(test.loop);
+    auto sa = srv->sockaddr().value();
+    HappyEyeballsSP he = new HappyEyeballs(test.loop, sa.ip(), sa.port(), Tcp::defhints, 10, 0, [&](auto&, auto& err) {
+        test.happens("result");
+        CHECK(err & std::errc::connection_refused);
+        test.loop->stop();
+    });
+    he->primary_failed(make_error_code(std::errc::connection_refused));
+    test.run();
+}
+
 TEST("client retains until request is complete") {
     AsyncTest test(1000);
     ClientPair p(test.loop);
@@ -4,6 +4,7 @@
 #include "panda/unievent/http/ServerRequest.h"
 #include "panda/unievent/http/ServerResponse.h"
 #include <cstdlib>
+#include <set>
 
 #define TEST(name) TEST_CASE("client-pool: " name, "[client-pool]" VSSL)
 
@@ -543,3 +544,929 @@ TEST("request timeout applied when not yet executing (queued) after redirect") {
     req1->response_event.remove_all();
     req1->cancel();
 }
+
+TEST("pipelining") {
+    AsyncTest test(5000);
+    Pool::Config cfg;
+    cfg.max_connections = 1;
+    cfg.pipeline_depth  = 2;
+    TPool p(cfg, test.loop);
+    auto srv = make_server(test.loop);
+    int connections = 0;
+    srv->connect_event.add([&](auto&) { ++connections; });
+    srv->request_event.add([&](auto& req) {
+        req->respond(new ServerResponse(200, Headers(), Body(req->uri->path())));
+    });
+
+    auto uri = active_scheme() +  "://" + srv->location();
+    std::vector<RequestSP> reqs;
+    for (int i = 0; i < 4; ++i) reqs.push_back(Request::Builder().method(Request::Method::Get).uri(uri + "/" + to_string(i)).build());
+
+    auto c0 = p.request(reqs[0]);
+    CHECK(p.request(reqs[1]) == c0);
+    CHECK(p.request(reqs[2]) == c0);
+    CHECK(!p.request(reqs[3])); // depth is exhausted, queued
+
+    auto post = Request::Builder().method(Request::Method::Post).uri(uri + "/post").body("x").build();
+    CHECK(!p.request(post)); // not idempotent, queued
+
+    reqs.push_back(post);
+    auto ress = await_responses(reqs, test.loop);
+    for (auto& res : ress) CHECK(res->code == 200);
+    CHECK(connections == 1);
+    CHECK(p.nbusy() == 0);
+}
+
+TEST("pipelined requests are matched in order") {
+    AsyncTest test(5000);
+    Pool::Config cfg;
+    cfg.max_connections = 1;
+    cfg.pipeline_depth  = 10;
+    TPool p(cfg, test.loop);
+    auto srv = make_server(test.loop);
+    srv->request_event.add([&](auto& req) {
+        req->respond(new ServerResponse(200, Headers(), Body(req->uri->path())));
+    });
+
+    auto uri = active_scheme() +  "://" + srv->location();
+    std::vector<string> got;
+    for (int i = 0; i < 5; ++i) {
+        auto req = Request::Builder().method(Request::Method::Get).uri(uri + "/" + to_string(i)).build();
+        req->response_event.add([&, i](auto, auto& res, auto& err) {
+            CHECK(!err);
+            CHECK(res->body.to_string() == "/" + to_string(i));
+            got.push_back(res->body.to_string());
+            if (got.size() == 5) test.loop->stop();
+        });
+        p.request(req);
+    }
+    test.run();
+    CHECK(got.size() == 5);
+}
+
+TEST("unanswered pipelined requests are resent when connection closes") {
+    AsyncTest test(5000);
+    Pool::Config cfg;
+    cfg.max_connections = 1;
+    cfg.pipeline_depth  = 2;
+    TPool p(cfg, test.loop);
+    auto srv = make_server(test.loop);
+    int connections = 0, nreq = 0;
+    srv->connect_event.add([&](auto&) { ++connections; });
+    srv->request_event.add([&](auto& req) {
+        auto res = new ServerResponse(200, Headers(), Body(req->uri->path()));
+        if (++nreq == 1) res->keep_alive(false); // pipelined requests on this connection are dropped by server
+        req->respond(res);
+    });
+
+    auto uri = active_scheme() +  "://" + srv->location();
+    std::vector<RequestSP> reqs;
+    for (int i = 0; i < 3; ++i) {
+        reqs.push_back(Request::Builder().method(Request::Method::Get).uri(uri + "/" + to_string(i)).build());
+        p.request(reqs.back());
+    }
+
+    auto ress = await_responses(reqs, test.loop);
+    std::set<string> bodies;
+    for (auto& res : ress) bodies.insert(res->body.to_string());
+    CHECK(bodies == std::set<string>{"/0", "/1", "/2"});
+    CHECK(connections == 2);
+}
+
+TEST("canceled pipelined request") {
+    AsyncTest test(5000, {"canceled", "r1", "r3"});
+    Pool::Config cfg;
+    cfg.max_connections = 1;
+    cfg.pipeline_depth  = 2;
+    TPool p(cfg, test.loop);
+    auto srv = make_server(test.loop);
+    srv->request_event.add([&](auto& req) {
+        test.loop->delay([req]{ req->respond(new ServerResponse(200, Headers(), Body(req->uri->path()))); });
+    });
+
+    auto uri = active_scheme() +  "://" + srv->location();
+    auto r1 = Request::Builder().method(Request::Method::Get).uri(uri + "/1").build();
+    auto r2 = Request::Builder().method(Request::Method::Get).uri(uri + "/2").build();
+    auto r3 = Request::Builder().method(Request::Method::Get).uri(uri + "/3").build();
+    r1->response_event.add([&](auto, auto& res, auto& err) { CHECK(!err); CHECK(res->body.to_string() == "/1"); test.happens("r1"); });
+    r2->response_event.add([&](auto, auto&, auto& err) { CHECK(err & std::errc::operation_canceled); test.happens("canceled"); });
+    r3->response_event.add([&](auto, auto& res, auto& err) {
+        CHECK(!err);
+        CHECK(res->body.to_string() == "/3"); // response to r2 is skipped
+        test.happens("r3");
+        test.loop->stop();
+    });
+    p.request(r1);
+    p.request(r2);
+    p.request(r3);
+    r2->cancel();
+    test.run();
+}
+
+TEST("canceled pipelined request is resubmitted") {
+    AsyncTest test(5000, {"canceled", "r1", "r2"});
+    Pool::Config cfg;
+    cfg.max_connections = 1;
+    cfg.pipeline_depth  = 2;
+    TPool p(cfg, test.loop);
+    auto srv = make_server(test.loop);
+    int nreq = 0;
+    srv->request_event.add([&](auto& req) {
+        auto body = req->uri->path() + "#" + to_string(++nreq);
+        test.loop->delay([req, body]{ req->respond(new ServerResponse(200, Headers(), Body(body))); });
+    });
+
+    auto uri = active_scheme() +  "://" + srv->location();
+    auto r1 = Request::Builder().method(Request::Method::Get).uri(uri + "/1").build();
+    auto r2 = Request::Builder().method(Request::Method::Get).uri(uri + "/2").build();
+    r1->response_event.add([&](auto, auto& res, auto& err) { CHECK(!err); CHECK(res->body.to_string() == "/1#1"); test.happens("r1"); });
+    int r2_calls = 0;
+    r2->response_event.add([&](auto, auto& res, auto& err) {
+        if (++r2_calls == 1) {
+            CHECK(err & std::errc::operation_canceled);
+            test.happens("canceled");
+            return;
+        }
+        CHECK(!err);
+        CHECK(res->body.to_string() == "/2#3"); // response to the canceled attempt (#2) is skipped
+        test.happens("r2");
+        test.loop->stop();
+    });
+    auto c = p.request(r1);
+    CHECK(p.request(r2) == c);
+    r2->cancel();
+    CHECK(p.request(r2) == c); // pipelined once again after the stand-in of canceled attempt
+    test.run();
+    CHECK(r2_calls == 2);
+    CHECK(r2->timings.dequeued <= r2->timings.first_byte);
+}
+
+TEST("requests in flight are finished after pool is destroyed") {
+    AsyncTest test(5000);
+    Pool::Config cfg;
+    cfg.max_connections = 1;
+    cfg.pipeline_depth  = 2;
+    cfg.timings         = true;
+    TPoolSP p = new TPool(cfg, test.loop);
+    auto srv = make_server(test.loop);
+    std::vector<ServerRequestSP> stalled;
+    srv->request_event.add([&](auto& req) {
+        stalled.push_back(req);
+        if (stalled.size() == 2) test.loop->stop();
+    });
+
+    auto uri = active_scheme() +  "://" + srv->location();
+    auto r1 = Request::Builder().method(Request::Method::Get).uri(uri + "/1").build();
+    auto r2 = Request::Builder().method(Request::Method::Get).uri(uri + "/2").build();
+    auto c = p->request(r1);
+    CHECK(p->request(r2) == c); // pipelined
+    test.run();
+
+    p = nullptr;
+    for (auto& req : stalled) req->respond(new ServerResponse(200));
+    for (auto& res : await_responses({r1, r2}, test.loop)) CHECK(res->code == 200);
+}
+
+TEST("50k queued requests time out at once") {
+    AsyncTest test(20000);
+    Pool::Config cfg;
+    cfg.max_connections = 1;
+    TPool p(cfg, test.loop);
+    auto srv = make_server(test.loop); // never responds
+    auto uri = active_scheme() +  "://" + srv->location() + "/";
+
+    auto first = Request::Builder().method(Request::Method::Get).uri(uri).timeout(0).build();
+    REQUIRE(p.request(first));
+
+    const int N = 50000;
+    int timed_out = 0, other = 0;
+    std::vector<RequestSP> reqs;
+    reqs.reserve(N);
+    for (int i = 0; i < N; ++i) {
+        auto req = Request::Builder().method(Request::Method::Get).uri(uri).timeout(10).build();
+        req->response_event.add([&](auto, auto, auto& err) {
+            if (err & std::errc::timed_out) ++timed_out;
+            else                            ++other;
+            if (timed_out + other == N) test.loop->stop();
+        });
+        p.request(req);
+        reqs.push_back(req);
+    }
+
+    time_mark();
+    test.run();
+    CHECK(timed_out == N);
+    CHECK(other == 0);
+    CHECK(time_elapsed() < 10000);
+    CHECK(p.nbusy() == 1);
+
+    first->cancel();
+}
+
+TEST("max_total_connections closes the oldest idle connection to another host") {
+    AsyncTest test(1000);
+    Pool::Config cfg;
+    cfg.max_total_connections = 2;
+    TPool p(cfg, test.loop);
+    auto srv1 = make_server(test.loop);
+    auto srv2 = make_server(test.loop);
+    auto srv3 = make_server(test.loop);
+    srv1->autorespond(new ServerResponse(200));
+    srv2->autorespond(new ServerResponse(200));
+    srv2->autorespond(new ServerResponse(200));
+    srv3->autorespond(new ServerResponse(200));
+
+    auto uri1 = active_scheme() +  "://" + srv1->location() + "/";
+    auto uri2 = active_scheme() +  "://" + srv2->location() + "/";
+    auto uri3 = active_scheme() +  "://" + srv3->location() + "/";
+
+    auto req = Request::Builder().method(Request::Method::Get).uri(uri1).build();
+    REQUIRE(p.request(req));
+    CHECK(await_response(req, test.loop)->code == 200);
+    test.wait(5); // so that connections have different last activity time
+
+    req = Request::Builder().method(Request::Method::Get).uri(uri2).build();
+    auto c2 = p.request(req);
+    REQUIRE(c2);
+    CHECK(await_response(req, test.loop)->code == 200);
+    CHECK(p.size() == 2);
+
+    req = Request::Builder().method(Request::Method::Get).uri(uri3).build();
+    REQUIRE(p.request(req)); // connection to srv1 is closed
+    CHECK(p.size() == 2);
+    CHECK(p.nqueued() == 0);
+    CHECK(await_response(req, test.loop)->code == 200);
+
+    req = Request::Builder().method(Request::Method::Get).uri(uri2).build();
+    CHECK(p.request(req) == c2);
+    CHECK(await_response(req, test.loop)->code == 200);
+    CHECK(p.size() == 2);
+}
+
+TEST("max_total_connections shares connections between hosts round-robin") {
+    AsyncTest test(1000);
+    Pool::Config cfg;
+    cfg.max_total_connections = 1;
+    TPool p(cfg, test.loop);
+    auto srv1 = make_server(test.loop);
+    auto srv2 = make_server(test.loop);
+    std::vector<string> order;
+    auto handler = [&](const ServerRequestSP& req) {
+        order.push_back(req->uri->path());
+        req->respond(new ServerResponse(200));
+    };
+    srv1->request_event.add(handler);
+    srv2->request_event.add(handler);
+
+    auto uri1 = active_scheme() +  "://" + srv1->location();
+    auto uri2 = active_scheme() +  "://" + srv2->location();
+    auto a1 = Request::Builder().method(Request::Method::Get).uri(uri1 + "/a1").build();
+    auto a2 = Request::Builder().method(Request::Method::Get).uri(uri1 + "/a2").build();
+    auto a3 = Request::Builder().method(Request::Method::Get).uri(uri1 + "/a3").build();
+    auto b1 = Request::Builder().method(Request::Method::Get).uri(uri2 + "/b1").build();
+
+    auto c = p.request(a1);
+    REQUIRE(c);
+    CHECK_FALSE(p.request(a2));
+    CHECK_FALSE(p.request(a3));
+    CHECK_FALSE(p.request(b1));
+    CHECK(p.size() == 1);
+    CHECK(p.nqueued() == 3);
+    CHECK(p.nqueued(c->last_netloc()) == 2);
+
+    auto responses = await_responses({a1, a2, a3, b1}, test.loop);
+    for (auto& res : responses) CHECK(res->code == 200);
+    CHECK(order == std::vector<string>({"/a1", "/a2", "/b1", "/a3"}));
+    CHECK(p.size() == 1);
+    CHECK(p.nqueued() == 0);
+}
+
+TEST("the most recently used connection is reused first") {
+    AsyncTest test(1000);
+    TPool p(test.loop);
+    auto srv = make_server(test.loop);
+    TimerSP t = new Timer(test.loop);
+    srv->request_event.add([&](const ServerRequestSP& req) {
+        if (req->uri->path() != "/slow") {
+            req->respond(new ServerResponse(200));
+            return;
+        }
+        t->event.add([req](auto&) { req->respond(new ServerResponse(200)); });
+        t->once(5);
+    });
+
+    auto uri = active_scheme() +  "://" + srv->location();
+    auto r1 = Request::Builder().method(Request::Method::Get).uri(uri + "/slow").build();
+    auto r2 = Request::Builder().method(Request::Method::Get).uri(uri + "/fast").build();
+    auto c1 = p.request(r1);
+    auto c2 = p.request(r2);
+    REQUIRE(c1);
+    REQUIRE(c2);
+    REQUIRE(c1 != c2);
+
+    for (auto& res : await_responses({r1, r2}, test.loop)) CHECK(res->code == 200);
+    CHECK(p.nbusy() == 0);
+
+    auto r3 = Request::Builder().method(Request::Method::Get).uri(uri + "/fast").build();
+    CHECK(p.request(r3) == c1); // c2 was freed earlier
+    CHECK(await_response(r3, test.loop)->code == 200);
+
+    auto r4 = Request::Builder().method(Request::Method::Get).uri(uri + "/fast").build();
+    CHECK(p.request(r4) == c1);
+    CHECK(await_response(r4, test.loop)->code == 200);
+    CHECK(p.size() == 2);
+}
+
+TEST("idle connections are removed at exact expiry time") {
+    AsyncTest test(3000);
+    Pool::Config cfg;
+    cfg.idle_timeout = 1200; // periodic checks every second would remove connection only after 2s
+    TPool p(cfg, test.loop);
+    auto srv = make_server(test.loop);
+    srv->autorespond(new ServerResponse(200));
+    srv->autorespond(new ServerResponse(200));
+
+    auto uri = active_scheme() +  "://" + srv->location() + "/";
+    auto r1 = Request::Builder().method(Request::Method::Get).uri(uri).build();
+    auto r2 = Request::Builder().method(Request::Method::Get).uri(uri).build();
+    REQUIRE(p.request(r1));
+    REQUIRE(p.request(r2));
+    for (auto& res : await_responses({r1, r2}, test.loop)) CHECK(res->code == 200);
+    CHECK(p.size() == 2);
+
+    test.wait(1000);
+    CHECK(p.size() == 2);
+    test.wait(500);
+    CHECK(p.size() == 0);
+    CHECK(p.empty());
+}
+
+TEST("prewarm") {
+    AsyncTest test(1000);
+    TPool p(test.loop);
+    auto srv = make_server(test.loop);
+    srv->autorespond(new ServerResponse(200));
+    auto uri = active_scheme() +  "://" + srv->location() + "/";
+
+    p.prewarm(Request::Builder().uri(uri).build(), 2);
+    CHECK(p.size() == 2);
+    CHECK(p.nbusy() == 0);
+    test.wait(50); // connections are established
+
+    auto req = Request::Builder().method(Request::Method::Get).uri(uri).build();
+    auto c = p.request(req);
+    REQUIRE(c);
+    CHECK(c->connected());
+    CHECK(p.size() == 2);
+    CHECK(await_response(req, test.loop)->code == 200);
+    CHECK(p.size() == 2);
+    CHECK(p.nbusy() == 0);
+}
+
+TEST("request on prewarmed connection which is still connecting") {
+    AsyncTest test(1000);
+    TPool p(test.loop);
+    auto srv = make_server(test.loop);
+    srv->autorespond(new ServerResponse(200));
+    auto uri = active_scheme() +  "://" + srv->location() + "/";
+
+    p.prewarm(Request::Builder().uri(uri).build(), 1);
+    auto req = Request::Builder().method(Request::Method::Get).uri(uri).build();
+    REQUIRE(p.request(req));
+    CHECK(await_response(req, test.loop)->code == 200);
+    CHECK(p.size() == 1);
+}
+
+TEST("min_idle connections are kept or refilled") {
+    AsyncTest test(1000);
+    Pool::Config cfg;
+    cfg.min_idle = 2;
+    Server::Config scfg;
+    bool reconnects = false;
+
+    SECTION("kept through idle timeout") {
+        cfg.idle_timeout = 20;
+    }
+    SECTION("refilled after server closes them") {
+        scfg.idle_timeout = 10;
+        reconnects = true;
+    }
+
+    TPool p(cfg, test.loop);
+    auto srv = make_server(test.loop, scfg);
+    int connections = 0;
+    srv->connect_event.add([&](auto&) { ++connections; });
+    auto uri = active_scheme() +  "://" + srv->location() + "/";
+
+    p.prewarm(Request::Builder().uri(uri).build());
+    CHECK(p.size() == 2);
+
+    test.wait(50);
+    CHECK(p.size() == 2);
+    CHECK(p.nbusy() == 0);
+    if (reconnects) CHECK(connections > 2);
+    else            CHECK(connections == 2);
+
+    p.min_idle(3);
+    CHECK(p.size() == 3);
+}
+
+TEST("tls session is resumed on reconnect") {
+    if (!secure) { return; }
+    AsyncTest test(1000);
+    TPool p(test.loop);
+    auto srv = make_server(test.loop);
+    srv->autorespond(new ServerResponse(200, Headers().connection("close")));
+    srv->autorespond(new ServerResponse(200, Headers().connection("close")));
+    auto uri = active_scheme() +  "://" + srv->location() + "/";
+
+    auto req = Request::Builder().method(Request::Method::Get).uri(uri).build();
+    REQUIRE(p.request(req));
+    CHECK(await_response(req, test.loop)->code == 200);
+    CHECK(p.tls_sessions().stats().misses == 1);
+    CHECK(p.tls_sessions().stats().hits == 0);
+
+    SECTION("resumed") {
+        CHECK(p.tls_sessions().count() == 1);
+        req = Request::Builder().method(Request::Method::Get).uri(uri).build();
+        REQUIRE(p.request(req));
+        CHECK(await_response(req, test.loop)->code == 200);
+        CHECK(p.tls_sessions().stats().hits == 1);
+        CHECK(p.tls_sessions().stats().misses == 1);
+    }
+    SECTION("disabled") {
+        p.tls_sessions().max_count(0);
+        CHECK(p.tls_sessions().count() == 0);
+        req = Request::Builder().method(Request::Method::Get).uri(uri).build();
+        REQUIRE(p.request(req));
+        CHECK(await_response(req, test.loop)->code == 200);
+        CHECK(p.tls_sessions().stats().hits == 0);
+    }
+}
+
+TEST("user's ssl context is left untouched") {
+    if (!secure) { return; }
+    AsyncTest test(1000);
+    TPool p(test.loop);
+    auto srv = make_server(test.loop);
+    srv->autorespond(new ServerResponse(200, Headers().connection("close")));
+    srv->autorespond(new ServerResponse(200, Headers().connection("close")));
+    auto uri = active_scheme() +  "://" + srv->location() + "/";
+    auto ctx = TClient::get_context("01-alice");
+    bool opt_in = GENERATE(false, true);
+    if (opt_in) Client::setup_ssl_context(ctx);
+
+    for (int i = 0; i < 2; ++i) {
+        auto req = Request::Builder().method(Request::Method::Get).uri(uri).ssl_ctx(ctx).build();
+        REQUIRE(p.request(req));
+        CHECK(await_response(req, test.loop)->code == 200);
+    }
+
+    if (opt_in) {
+        CHECK(p.tls_sessions().stats().hits == 1);
+    } else {
+        CHECK(SSL_CTX_sess_get_new_cb(ctx) == nullptr);
+        CHECK(p.tls_sessions().count() == 0);
+        CHECK(p.tls_sessions().stats().hits == 0);
+    }
+}
+
+TEST("requests with equal ssl configs share connections") {
+    if (!secure) { return; }
+    AsyncTest test(1000);
+    TPool p(test.loop);
+    auto srv = make_server(test.loop);
+    srv->autorespond(new ServerResponse(200));
+    srv->autorespond(new ServerResponse(200));
+    auto uri = active_scheme() +  "://" + srv->location() + "/";
+
+    SslConfig cfg;
+    cfg.verify    = false;
+    cfg.cert_file = "tests/cert/01-alice.pem";
+    cfg.key_file  = "tests/cert/01-alice.key";
+    CHECK(ssl_context(cfg) == ssl_context(SslConfig(cfg)));
+    CHECK(ssl_context(cfg) != Client::get_default_ssl_context(false));
+
+    auto req1 = Request::Builder().method(Request::Method::Get).uri(uri).ssl_config(cfg).build();
+    auto c1 = p.request(req1);
+    REQUIRE(c1);
+    CHECK(await_response(req1, test.loop)->code == 200);
+
+    auto req2 = Request::Builder().method(Request::Method::Get).uri(uri).ssl_config(cfg).build();
+    CHECK(p.request(req2) == c1);
+    CHECK(await_response(req2, test.loop)->code == 200);
+    CHECK(p.size() == 1);
+}
+
+struct TResolver : DnsCache::IResolver {
+    LoopSP        loop;
+    net::SockAddr   addr;
+    DnsCache::Addrs addrs; // returned instead of addr if set
+    ErrorCode       error;
+    int             calls = 0;
+
+    TResolver (const LoopSP& loop) : loop(loop) {}
+
+    void resolve (const string&, uint16_t, const AddrInfoHints&, const Callback& cb) override {
+        ++calls;
+        auto ret = addrs.size() ? addrs : DnsCache::Addrs{addr};
+        auto err = error;
+        loop->delay([cb, ret, err]{ cb(err ? DnsCache::Addrs() : ret, err, 0); });
+    }
+};
+
+TEST("dns cache") {
+    AsyncTest test(1000);
+    TResolver resolver(test.loop);
+    Pool::Config cfg;
+    cfg.dns.ttl      = 60000;
+    cfg.dns.resolver = &resolver;
+
+    auto srv = make_server(test.loop);
+    for (int i = 0; i < 3; ++i) srv->autorespond(new ServerResponse(200, Headers().connection("close")));
+    resolver.addr = srv->sockaddr().value();
+    auto uri = active_scheme() +  "://" + srv->location() + "/";
+    auto new_req = [&]{ return Request::Builder().method(Request::Method::Get).uri(uri).build(); };
+
+    SECTION("concurrent lookups wait for a single resolve, then addresses are cached") {
+        TPool p(cfg, test.loop);
+        auto r1 = new_req(), r2 = new_req();
+        p.request(r1);
+        p.request(r2);
+        for (auto& res : await_responses({r1, r2}, test.loop)) CHECK(res->code == 200);
+        CHECK(resolver.calls == 1);
+        CHECK(p.dns().stats().misses == 1);
+        CHECK(p.dns().stats().coalesced == 1);
+
+        auto r3 = new_req();
+        p.request(r3);
+        CHECK(await_response(r3, test.loop)->code == 200);
+        CHECK(resolver.calls == 1);
+        CHECK(p.dns().stats().hits == 1);
+    }
+
+    SECTION("expired entry is served while being refreshed") {
+        cfg.dns.ttl       = 10;
+        cfg.dns.stale_ttl = 1000;
+        TPool p(cfg, test.loop);
+        auto r1 = new_req();
+        p.request(r1);
+        CHECK(await_response(r1, test.loop)->code == 200);
+        test.wait(20);
+
+        auto r2 = new_req();
+        p.request(r2);
+        CHECK(p.dns().stats().stale_hits == 1);
+        CHECK(p.dns().stats().prefetches == 1);
+        CHECK(resolver.calls == 2);
+        CHECK(await_response(r2, test.loop)->code == 200);
+    }
+
+    SECTION("hot entry is refreshed before it expires") {
+        cfg.dns.ttl           = 200;
+        cfg.dns.prefetch_hits = 1;
+        TPool p(cfg, test.loop);
+        auto r1 = new_req();
+        p.request(r1);
+        CHECK(await_response(r1, test.loop)->code == 200);
+        test.wait(160);
+
+        auto r2 = new_req();
+        p.request(r2);
+        CHECK(p.dns().stats().hits == 1);
+        CHECK(p.dns().stats().prefetches == 1);
+        CHECK(resolver.calls == 2);
+        CHECK(await_response(r2, test.loop)->code == 200);
+    }
+
+    SECTION("failures are cached") {
+        resolver.error = make_error_code(std::errc::host_unreachable);
+        TPool p(cfg, test.loop);
+        for (int i = 0; i < 2; ++i) {
+            auto req = new_req();
+            req->response_event.add([&](auto, auto&, auto& err){
+                CHECK(err & errc::connect_error);
+                CHECK(err & std::errc::host_unreachable);
+                test.loop->stop();
+            });
+            p.request(req);
+            test.run();
+        }
+        CHECK(resolver.calls == 1);
+        CHECK(p.dns().stats().misses == 1);
+        CHECK(p.dns().stats().negative_hits == 1);
+    }
+
+    SECTION("disabled by default") {
+        cfg.dns = DnsCache::Config();
+        cfg.dns.resolver = &resolver;
+        TPool p(cfg, test.loop);
+        auto r1 = new_req();
+        p.request(r1);
+        CHECK(await_response(r1, test.loop)->code == 200);
+        CHECK(resolver.calls == 0);
+        CHECK(p.dns().count() == 0);
+    }
+}
+
+TEST("connection race takes addresses from dns cache") {
+    AsyncTest test(1000);
+    TResolver resolver(test.loop);
+    Pool::Config cfg;
+    cfg.dns.ttl      = 60000;
+    cfg.dns.resolver = &resolver;
+
+    auto srv = make_server(test.loop);
+    srv->autorespond(new ServerResponse(200));
+    resolver.addrs = {test.get_blackhole_addr(), srv->sockaddr().value()};
+    TPool p(cfg, test.loop);
+
+    auto uri = active_scheme() +  "://" + srv->location() + "/";
+    auto req = Request::Builder().method(Request::Method::Get).uri(uri).connect_attempt_delay(10).connect_timeout(500).build();
+    REQUIRE(p.request(req));
+    CHECK(await_response(req, test.loop)->code == 200);
+    CHECK(resolver.calls == 1);
+}
+
+TEST("next resolved address is tried when connection fails") {
+    AsyncTest test(1000);
+    TResolver resolver(test.loop);
+    Pool::Config cfg;
+    cfg.dns.ttl      = 60000;
+    cfg.dns.resolver = &resolver;
+
+    auto dead = make_server(test.loop);
+    auto refused = dead->sockaddr().value();
+    dead = nullptr;
+    auto srv = make_server(test.loop);
+    srv->autorespond(new ServerResponse(200));
+    resolver.addrs = {refused, srv->sockaddr().value()};
+    TPool p(cfg, test.loop);
+
+    auto uri = active_scheme() +  "://" + srv->location() + "/";
+    auto req = Request::Builder().method(Request::Method::Get).uri(uri).connect_attempt_delay(0).build();
+
+    SECTION("next one accepts") {
+        REQUIRE(p.request(req));
+        CHECK(await_response(req, test.loop)->code == 200);
+    }
+
+    SECTION("every address fails") {
+        resolver.addrs = {refused, refused};
+        req->response_event.add([&](auto, auto&, auto& err){
+            CHECK(err & errc::connect_error);
+            CHECK(err & std::errc::connection_refused);
+            test.loop->stop();
+        });
+        p.request(req);
+        test.run();
+    }
+}
+
+TEST("hedging") {
+    AsyncTest test(1000);
+    Pool::Config cfg;
+    cfg.hedge_budget = 100;
+    auto srv = make_server(test.loop);
+    std::vector<ServerRequestSP> stalled;
+    int nreq = 0;
+    TimerSP t = new Timer(test.loop);
+    srv->request_event.add([&](const ServerRequestSP& req) {
+        ++nreq;
+        if (req->uri->path() == "/slow" && nreq == 1) {
+            stalled.push_back(req);
+            t->event.add([req](auto&) { req->respond(new ServerResponse(200, Headers(), Body("1"))); });
+            t->once(100);
+            return;
+        }
+        req->respond(new ServerResponse(200, Headers(), Body(panda::to_string(nreq))));
+    });
+
+    auto uri = active_scheme() +  "://" + srv->location();
+    HedgePolicy policy;
+    policy.delay = 10;
+
+    SECTION("duplicate wins") {
+        TPool p(cfg, test.loop);
+        auto req = Request::Builder().method(Request::Method::Get).uri(uri + "/slow").hedge(policy).build();
+        REQUIRE(p.request(req));
+        auto res = await_response(req, test.loop);
+        CHECK(res->body.to_string() == "2");
+        CHECK(nreq == 2);
+        CHECK(p.hedge_stats().requests == 1);
+        CHECK(p.hedge_stats().hedges == 1);
+        CHECK(p.hedge_stats().wins == 1);
+    }
+
+    SECTION("no duplicate when answered in time") {
+        TPool p(cfg, test.loop);
+        auto req = Request::Builder().method(Request::Method::Get).uri(uri + "/fast").hedge(policy).build();
+        REQUIRE(p.request(req));
+        CHECK(await_response(req, test.loop)->body.to_string() == "1");
+        test.wait(20);
+        CHECK(nreq == 1);
+        CHECK(p.hedge_stats().hedges == 0);
+    }
+
+    SECTION("budget") {
+        cfg.hedge_budget = 10;
+        TPool p(cfg, test.loop);
+        auto req = Request::Builder().method(Request::Method::Get).uri(uri + "/slow").hedge(policy).build();
+        REQUIRE(p.request(req));
+        CHECK(await_response(req, test.loop)->body.to_string() == "1");
+        CHECK(nreq == 1);
+        CHECK(p.hedge_stats().throttled == 1);
+    }
+
+    SECTION("not idempotent requests are not hedged") {
+        TPool p(cfg, test.loop);
+        auto req = Request::Builder().method(Request::Method::Post).uri(uri + "/slow").hedge(policy).build();
+        REQUIRE(p.request(req));
+        CHECK(await_response(req, test.loop)->body.to_string() == "1");
+        CHECK(p.hedge_stats().requests == 0);
+    }
+
+    SECTION("cancel") {
+        TPool p(cfg, test.loop);
+        auto req = Request::Builder().method(Request::Method::Get).uri(uri + "/slow").hedge(policy).build();
+        req->response_event.add([&](auto, auto&, auto& err) {
+            CHECK(err & std::errc::operation_canceled);
+            test.loop->stop();
+        });
+        REQUIRE(p.request(req));
+        test.loop->delay([&]{ req->cancel(); });
+        test.run();
+        CHECK(p.hedge_stats().hedges == 0);
+    }
+}
+
+TEST("hedging percentile is learned from every request to the host") {
+    AsyncTest test(1000);
+    Pool::Config cfg;
+    cfg.hedge_budget = 100;
+    auto srv = make_server(test.loop);
+    std::vector<ServerRequestSP> stalled;
+    int nreq = 0;
+    srv->request_event.add([&](const ServerRequestSP& req) {
+        ++nreq;
+        if (req->uri->path() == "/slow" && stalled.empty()) {
+            stalled.push_back(req);
+            return;
+        }
+        req->respond(new ServerResponse(200, Headers(), Body("fast")));
+    });
+    TPool p(cfg, test.loop);
+    auto uri = active_scheme() +  "://" + srv->location();
+
+    std::vector<RequestSP> reqs;
+    for (int i = 0; i < 20; ++i) {
+        reqs.push_back(Request::Builder().method(Request::Method::Get).uri(uri + "/").build());
+        p.request(reqs.back());
+    }
+    for (auto& res : await_responses(reqs, test.loop)) CHECK(res->code == 200);
+
+    HedgePolicy policy;
+    policy.percentile = 50;
+    policy.delay      = 5000; // would be used if un-hedged requests were not taken into account
+    auto req = Request::Builder().method(Request::Method::Get).uri(uri + "/slow").hedge(policy).build();
+    REQUIRE(p.request(req));
+    CHECK(await_response(req, test.loop)->body.to_string() == "fast");
+    CHECK(nreq == 22);
+    CHECK(p.hedge_stats().wins == 1);
+}
+
+TEST("request is resent when connection is lost before response") {
+    AsyncTest test(1000);
+    TPool p(test.loop);
+    auto srv = make_server(test.loop);
+    int nreq  = 0;
+    int drops = 1;
+    int drop_at = 2;
+    srv->request_event.add([&](const ServerRequestSP& req) {
+        if (++nreq >= drop_at && drops) {
+            --drops;
+            req->drop();
+            return;
+        }
+        req->respond(new ServerResponse(200, Headers(), Body(panda::to_string(nreq))));
+    });
+
+    auto uri = active_scheme() +  "://" + srv->location() + "/";
+    auto send = [&](const RequestSP& req) -> ErrorCode {
+        ErrorCode ret;
+        req->response_event.add([&](auto, auto& res, auto& err) {
+            ret = err;
+            if (!err) CHECK(res->body.to_string() == panda::to_string(nreq));
+            test.loop->stop();
+        });
+        p.request(req);
+        test.run();
+        return ret;
+    };
+
+    SECTION("reused connection") {
+        CHECK_FALSE(send(Request::Builder().method(Request::Method::Get).uri(uri).build()));
+
+        SECTION("idempotent") {
+            CHECK_FALSE(send(Request::Builder().method(Request::Method::Get).uri(uri).build()));
+            CHECK(nreq == 3);
+        }
+        SECTION("with idempotency key") {
+            CHECK_FALSE(send(Request::Builder().method(Request::Method::Post).header("Idempotency-Key", "1").uri(uri).build()));
+            CHECK(nreq == 3);
+        }
+        SECTION("not idempotent") {
+            CHECK(send(Request::Builder().method(Request::Method::Post).uri(uri).build()));
+            CHECK(nreq == 2);
+        }
+        SECTION("retries are off") {
+            RetryPolicy policy;
+            policy.max_attempts = 1;
+            CHECK(send(Request::Builder().method(Request::Method::Get).uri(uri).retry(policy).build()));
+            CHECK(nreq == 2);
+        }
+    }
+
+    SECTION("new connection") {
+        drop_at = 1;
+        SECTION("is not retried by default") {
+            CHECK(send(Request::Builder().method(Request::Method::Get).uri(uri).build()));
+            CHECK(nreq == 1);
+        }
+        SECTION("is retried after backoff") {
+            RetryPolicy policy;
+            policy.new_connections = true;
+            policy.backoff         = 20;
+            time_mark();
+            CHECK_FALSE(send(Request::Builder().method(Request::Method::Get).uri(uri).retry(policy).build()));
+            CHECK(time_elapsed() >= 19);
+            CHECK(nreq == 2);
+        }
+    }
+}
+
+TEST("request timings") {
+    AsyncTest test(1000);
+    Pool::Config cfg;
+    cfg.max_connections = 1;
+    TPool p(cfg, test.loop);
+    auto srv = make_server(test.loop);
+    srv->request_event.add([](const ServerRequestSP& req) {
+        req->respond(new ServerResponse(200, Headers(), Body("hi")));
+    });
+    using time_point = RequestTimings::time_point;
+    bool secure = active_scheme() == "https";
+
+    auto uri = active_scheme() +  "://" + srv->location() + "/";
+    auto req1 = Request::Builder().method(Request::Method::Get).uri(uri).build();
+    auto req2 = Request::Builder().method(Request::Method::Get).uri(uri).build();
+    auto c = p.request(req1);
+    REQUIRE(c);
+    CHECK_FALSE(p.request(req2)); // queued
+    await_responses({req1, req2}, test.loop);
+
+    auto& t1 = req1->timings;
+    CHECK(t1.queued != time_point());
+    CHECK(t1.queued <= t1.dequeued);
+    CHECK(t1.dequeued <= t1.connected);
+    CHECK((t1.tls != time_point()) == secure);
+    if (secure) CHECK(t1.connected <= t1.tls);
+    CHECK(t1.connected <= t1.written);
+    CHECK(t1.written <= t1.first_byte);
+    CHECK(t1.first_byte <= t1.done);
+
+    auto& t2 = req2->timings; // sent on the same connection after the first one is answered
+    CHECK(t2.connected == time_point());
+    CHECK(t2.tls == time_point());
+    CHECK(t2.dequeued >= t1.done);
+    CHECK(t2.written != time_point());
+    CHECK(t2.first_byte <= t2.done);
+
+    auto host = p.timings(c->last_netloc());
+    REQUIRE(host);
+    CHECK(host->total.count() == 2);
+    CHECK(host->queue.count() == 2);
+    CHECK(host->connect.count() == 1);
+    CHECK(host->tls.count() == (secure ? 1 : 0));
+    CHECK(host->send.count() == 2);
+    CHECK(host->wait.count() == 2);
+    CHECK(host->receive.count() == 2);
+    CHECK(p.timings().total.count() == 2);
+
+    SECTION("failed requests are not recorded") {
+        auto req = Request::Builder().uri(active_scheme() + "://127.0.0.1:1/").build();
+        p.request(req);
+        await_response(req, test.loop);
+        CHECK(p.timings().total.count() == 2);
+    }
+
+    SECTION("disabled") {
+        cfg.timings = false;
+        TPool p2(cfg, test.loop);
+        auto req = Request::Builder().uri(uri).build();
+        p2.request(req);
+        await_response(req, test.loop);
+        CHECK(p2.timings().total.count() == 0);
+        CHECK(req->timings.done != time_point()); // request's own timings are always filled
+    }
+}
@@ -106,3 +106,29 @@ TEST("ssl verify server cert fail") {
 
     secure = false;
 }
+
+TEST("http/1.1 is negotiated via alpn") {
+    secure = true;
+    AsyncTest test(1000);
+    bool alpn = GENERATE(true, false);
+    Server::Location loc;
+    loc.host = "127.0.0.1";
+    loc.alpn = alpn;
+    Server::Config cfg;
+    cfg.locations.push_back(loc);
+    auto server = make_server(test.loop, cfg);
+    server->enable_echo();
+    TClientSP client = new TClient(test.loop);
+    client->sa = server->sockaddr().value();
+
+    auto req = Request::Builder().method(Request::Method::Get).uri("/").ssl_ctx(TClient::get_context("01-alice")).build();
+    auto res = client->get_response(req);
+    CHECK(res->code == 200);
+
+    const unsigned char* proto = nullptr;
+    unsigned len = 0;
+    SSL_get0_alpn_selected(client->get_ssl(), &proto, &len);
+    if (alpn) CHECK(string((const char*)proto, len) == "http/1.1");
+    else      CHECK(len == 0); // ssl_ctx is left untouched unless asked
+    secure = false;
+}
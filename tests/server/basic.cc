@@ -488,4 +488,57 @@ TEST("graceful stop") {
         
         test.run();
     }
-}
\ No newline at end of file
+}
+
+TEST("connections removed out of order") {
+    AsyncTest test(2000, {"stop"});
+    auto srv = make_server(test.loop);
+    std::vector<TcpSP> conns;
+    int connected = 0;
+    srv->connect_event.add([&](auto&) {
+        if (++connected == 5) test.loop->stop();
+    });
+    for (int i = 0; i < 5; ++i) {
+        TcpSP conn = new Tcp(test.loop);
+        if (secure) conn->use_ssl(TClient::get_context("01-alice"));
+        conn->connect(srv->sockaddr().value());
+        conns.push_back(conn);
+    }
+    test.run();
+
+    conns[1]->reset();
+    conns[3]->reset();
+    test.wait(10);
+
+    int eofs = 0;
+    for (auto i : {0, 2, 4}) conns[i]->eof_event.add([&](auto...) { ++eofs; });
+    srv->stop_event.add([&]{ test.happens("stop"); });
+    srv->graceful_stop();
+    test.wait(50);
+    CHECK(eofs == 3);
+}
+
+TEST("http/2 prior knowledge is refused") {
+    AsyncTest test(1000);
+    ServerPair p(test.loop);
+    string got;
+    p.conn->read_event.add([&](auto, auto& str, auto& err) {
+        if (err) throw err;
+        got += str;
+    });
+    p.conn->eof_event.add([&](auto) { test.loop->stop(); });
+    TimerSP t = new Timer(test.loop);
+    SECTION("at once") {
+        p.conn->write("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+    }
+    SECTION("split across reads") {
+        p.conn->write("PRI * HT");
+        t->event.add([&](auto) { p.conn->write("TP/2.0\r\n\r\nSM\r\n\r\n"); });
+        t->once(10);
+    }
+    test.run();
+    REQUIRE(got.length() == 26);
+    CHECK(got[3] == 0x04);  // SETTINGS
+    CHECK(got[12] == 0x07); // GOAWAY
+    CHECK(got[25] == 0x0d); // HTTP_1_1_REQUIRED
+}
@@ -0,0 +1,142 @@
+#include "../lib/test.h"
+
+#define TEST(name) TEST_CASE("server-cache: " name, "[server-cache]" VSSL)
+
+static Server::Config cache_config (size_t size = 1000000) {
+    Server::Config cfg;
+    cfg.cache_size = size;
+    return cfg;
+}
+
+TEST("fresh response is served from cache") {
+    AsyncTest test(1000);
+    ServerPair p(test.loop, cache_config());
+    int calls = 0;
+    p.server->request_event.add([&](auto& req) {
+        ++calls;
+        req->respond(new ServerResponse(200, Headers().add("Cache-Control", "max-age=60"), Body("cached")));
+    });
+
+    for (int i = 0; i < 3; ++i) {
+        auto res = p.get_response("GET /a HTTP/1.1\r\nHost: epta.ru\r\n\r\n");
+        CHECK(res->code == 200);
+        CHECK(res->body.to_string() == "cached");
+        CHECK(res->keep_alive());
+    }
+    CHECK(calls == 1);
+    CHECK(p.server->cache()->stats().hits == 2);
+    CHECK(p.server->cache()->count() == 1);
+
+    p.get_response("GET /b HTTP/1.1\r\nHost: epta.ru\r\n\r\n");
+    p.get_response("GET /a HTTP/1.1\r\nHost: epta.ru\r\nCache-Control: no-cache\r\n\r\n");
+    CHECK(calls == 3);
+}
+
+TEST("not cacheable responses") {
+    AsyncTest test(1000);
+    ServerPair p(test.loop, cache_config());
+    Headers headers;
+    SECTION("no freshness")    {}
+    SECTION("no-store")        { headers.add("Cache-Control", "max-age=60, no-store"); }
+    SECTION("private")         { headers.add("Cache-Control", "private, max-age=60"); }
+    SECTION("set-cookie")      { headers.add("Cache-Control", "max-age=60").add("Set-Cookie", "a=b"); }
+    SECTION("vary *")          { headers.add("Cache-Control", "max-age=60").add("Vary", "*"); }
+    SECTION("expired Expires") { headers.add("Cache-Control", "public").add("Expires", "Sun, 06 Nov 1994 08:49:37 GMT"); }
+
+    int calls = 0;
+    p.server->request_event.add([&](auto& req) {
+        ++calls;
+        req->respond(new ServerResponse(200, Headers(headers), Body("hi")));
+    });
+    p.get_response("GET / HTTP/1.1\r\n\r\n");
+    p.get_response("GET / HTTP/1.1\r\n\r\n");
+    CHECK(calls == 2);
+    CHECK(p.server->cache()->count() == 0);
+}
+
+TEST("conditional requests") {
+    AsyncTest test(1000);
+    ServerPair p(test.loop, cache_config());
+    p.server->autorespond(new ServerResponse(200, Headers().add("Cache-Control", "max-age=60").add("ETag", "\"v1\"")
+                                                           .add("Last-Modified", "Sun, 06 Nov 1994 08:49:37 GMT"), Body("content")));
+    p.get_response("GET / HTTP/1.1\r\n\r\n");
+
+    SECTION("if-none-match") {
+        auto res = p.get_response("GET / HTTP/1.1\r\nIf-None-Match: \"v0\", W/\"v1\"\r\n\r\n");
+        CHECK(res->code == 304);
+        CHECK(res->headers.get("ETag") == "\"v1\"");
+        CHECK(res->body.to_string() == "");
+        res = p.get_response("GET / HTTP/1.1\r\nIf-None-Match: \"v2\"\r\n\r\n");
+        CHECK(res->code == 200);
+        CHECK(res->body.to_string() == "content");
+    }
+    SECTION("if-modified-since") {
+        auto res = p.get_response("GET / HTTP/1.1\r\nIf-Modified-Since: Mon, 07 Nov 1994 08:49:37 GMT\r\n\r\n");
+        CHECK(res->code == 304);
+        res = p.get_response("GET / HTTP/1.1\r\nIf-Modified-Since: Sat, 05 Nov 1994 08:49:37 GMT\r\n\r\n");
+        CHECK(res->code == 200);
+    }
+    CHECK(p.server->cache()->stats().not_modified == 1);
+}
+
+TEST("vary") {
+    AsyncTest test(1000);
+    ServerPair p(test.loop, cache_config());
+    int calls = 0;
+    p.server->request_event.add([&](auto& req) {
+        ++calls;
+        auto lang = req->headers.get("Accept-Language");
+        req->respond(new ServerResponse(200, Headers().add("Cache-Control", "max-age=60").add("Vary", "Accept-Language"), Body(lang)));
+    });
+    CHECK(p.get_response("GET / HTTP/1.1\r\nAccept-Language: en\r\n\r\n")->body.to_string() == "en");
+    CHECK(p.get_response("GET / HTTP/1.1\r\nAccept-Language: ru\r\n\r\n")->body.to_string() == "ru");
+    CHECK(p.get_response("GET / HTTP/1.1\r\nAccept-Language: en\r\n\r\n")->body.to_string() == "en");
+    CHECK(calls == 2);
+    CHECK(p.server->cache()->count() == 2);
+}
+
+TEST("concurrent misses are coalesced") {
+    AsyncTest test(1000);
+    ServerPair p(test.loop, cache_config());
+    int calls = 0;
+    p.server->request_event.add([&](auto& req) {
+        ++calls;
+        test.loop->delay([req]{
+            req->respond(new ServerResponse(200, Headers().add("Cache-Control", "max-age=60"), Body("slow")));
+        });
+    });
+    p.conn->write("GET / HTTP/1.1\r\n\r\nGET / HTTP/1.1\r\n\r\n");
+    CHECK(p.get_response()->body.to_string() == "slow");
+    CHECK(p.get_response()->body.to_string() == "slow");
+    CHECK(calls == 1);
+    CHECK(p.server->cache()->stats().coalesced == 1);
+}
+
+TEST("uncacheable response to coalesced requests") {
+    AsyncTest test(1000);
+    ServerPair p(test.loop, cache_config());
+    int calls = 0;
+    p.server->request_event.add([&](auto& req) {
+        ++calls;
+        test.loop->delay([req]{ req->respond(new ServerResponse(200, Headers(), Body("fresh"))); });
+    });
+    p.conn->write("GET / HTTP/1.1\r\n\r\nGET / HTTP/1.1\r\n\r\n");
+    CHECK(p.get_response()->body.to_string() == "fresh");
+    CHECK(p.get_response()->body.to_string() == "fresh");
+    CHECK(calls == 2);
+}
+
+TEST("lru eviction") {
+    AsyncTest test(1000);
+    ServerPair p(test.loop, cache_config(3000));
+    p.server->request_event.add([&](auto& req) {
+        req->respond(new ServerResponse(200, Headers().add("Cache-Control", "max-age=60"), Body(string(1000, 'x'))));
+    });
+    p.get_response("GET /1 HTTP/1.1\r\n\r\n");
+    p.get_response("GET /2 HTTP/1.1\r\n\r\n");
+    p.get_response("GET /3 HTTP/1.1\r\n\r\n");
+    auto cache = p.server->cache();
+    CHECK(cache->size() <= 3000);
+    CHECK(cache->stats().evicted >= 1);
+    CHECK(cache->count() == 3 - cache->stats().evicted);
+}
@@ -0,0 +1,95 @@
+#include "../lib/test.h"
+
+#define TEST(name) TEST_CASE("server-frozen: " name, "[server-frozen]" VSSL)
+
+TEST("same response for many requests") {
+    AsyncTest test(1000);
+    ServerPair p(test.loop);
+    ServerResponseSP fres = new ServerResponse(200, Headers().add("Content-Type", "application/json"), Body("{\"status\":\"ok\"}"));
+    fres->freeze();
+    CHECK(fres->frozen());
+    p.server->request_event.add([&](auto& req) { req->respond(fres); });
+
+    for (int i = 0; i < 3; ++i) {
+        auto res = p.get_response("GET / HTTP/1.1\r\n\r\n");
+        CHECK(res->code == 200);
+        CHECK(res->http_version == 11);
+        CHECK(res->headers.get("Content-Type") == "application/json");
+        CHECK(res->headers.has("Date"));
+        CHECK(res->body.to_string() == "{\"status\":\"ok\"}");
+        CHECK(res->keep_alive());
+    }
+    CHECK(!p.wait_eof(5));
+}
+
+TEST("changes after freeze are ignored") {
+    AsyncTest test(1000);
+    ServerPair p(test.loop);
+    ServerResponseSP fres = new ServerResponse(204);
+    fres->freeze();
+    fres->headers.add("X-Late", "1");
+    p.server->autorespond(fres);
+    auto res = p.get_response("GET / HTTP/1.1\r\n\r\n");
+    CHECK(res->code == 204);
+    CHECK(!res->headers.has("X-Late"));
+}
+
+TEST("connection header is per request") {
+    AsyncTest test(1000);
+    ServerPair p(test.loop);
+    ServerResponseSP fres = new ServerResponse(200, Headers(), Body("hi"));
+    fres->freeze();
+    p.server->request_event.add([&](auto& req) { req->respond(fres); });
+    RawResponseSP res;
+
+    SECTION("1.0 and C=KA") {
+        res = p.get_response("GET / HTTP/1.0\r\nConnection: keep-alive\r\n\r\n");
+        CHECK(res->http_version == 10);
+        CHECK(res->keep_alive());
+        CHECK(!p.wait_eof(5));
+    }
+    SECTION("1.0 and no C") {
+        res = p.get_response("GET / HTTP/1.0\r\n\r\n");
+        CHECK(res->http_version == 10);
+        CHECK_FALSE(res->keep_alive());
+        p.wait_eof();
+    }
+    SECTION("1.1 and C=CLOSE") {
+        res = p.get_response("GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+        CHECK(res->headers.connection() == "close");
+        p.wait_eof();
+    }
+    CHECK(res->body.to_string() == "hi");
+}
+
+TEST("user's close") {
+    AsyncTest test(1000);
+    ServerPair p(test.loop);
+    ServerResponseSP fres = new ServerResponse(200, Headers().connection("close"), Body("hi"));
+    fres->freeze();
+    p.server->autorespond(fres);
+    auto res = p.get_response("GET / HTTP/1.1\r\n\r\n");
+    CHECK(res->headers.connection() == "close");
+    p.wait_eof();
+}
+
+TEST("no body for HEAD") {
+    AsyncTest test(1000);
+    ServerPair p(test.loop);
+    ServerResponseSP fres = new ServerResponse(200, Headers(), Body("hello"));
+    fres->freeze();
+    p.server->autorespond(fres);
+    p.source_request = new RawRequest(Request::Method::Head, new URI("/"));
+    auto res = p.get_response("HEAD / HTTP/1.1\r\n\r\n");
+    CHECK(res->code == 200);
+    CHECK(res->headers.get("Content-Length") == "5");
+    CHECK(res->body.to_string() == "");
+}
+
+TEST("can't freeze chunked or compressed") {
+    ServerResponseSP res = new ServerResponse(200, Headers(), Body(), true);
+    CHECK_THROWS_AS(res->freeze(), HttpError);
+    res = new ServerResponse(200, Headers(), Body("hi"));
+    res->compression.type = Compression::GZIP;
+    CHECK_THROWS_AS(res->freeze(), HttpError);
+}
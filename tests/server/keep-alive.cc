@@ -147,6 +147,28 @@ TEST("idle timeout during and after request") {
     CHECK(time_elapsed() >= cfg.idle_timeout - 1);
 }
 
+TEST("idle timeout for many connections") {
+    AsyncTest test(2000);
+    Server::Config cfg;
+    cfg.idle_timeout = 30;
+    auto srv = make_server(test.loop, cfg);
+    std::vector<TcpSP> conns;
+    int eofs = 0;
+    time_mark();
+    for (int i = 0; i < 10; ++i) {
+        TcpSP conn = new Tcp(test.loop);
+        if (secure) conn->use_ssl(TClient::get_context("01-alice"));
+        conn->connect(srv->sockaddr().value());
+        conn->eof_event.add([&](auto...) {
+            CHECK(time_elapsed() >= cfg.idle_timeout - 1);
+            if (++eofs == 10) test.loop->stop();
+        });
+        conns.push_back(conn);
+    }
+    test.run();
+    CHECK(eofs == 10);
+}
+
 TEST("max keepalive requests") {
     AsyncTest test(1000);
     Server::Config cfg;
@@ -166,3 +188,40 @@ TEST("max keepalive requests") {
     CHECK_FALSE(res->keep_alive());
     p.wait_eof();
 }
+
+TEST("idle timeout reconfigured while connections are idle") {
+    AsyncTest test(2000);
+    Server::Config cfg;
+    cfg.idle_timeout = 400;
+    ServerPair p(test.loop, cfg);
+    p.get_response("GET / HTTP/1.1\r\n\r\n"); // connection's idle timer is armed now
+    time_mark();
+
+    Server::Location loc;
+    loc.host = "127.0.0.1";
+    if (secure) loc.ssl_ctx = TServer::get_context("ca");
+    cfg.locations.push_back(loc);
+    cfg.idle_timeout = 20;
+    p.server->configure(cfg); // tick of the wheel changes while an entry is armed
+
+    auto srv = p.server;
+    TcpSP conn = new Tcp(test.loop);
+    if (secure) conn->use_ssl(TClient::get_context("01-alice"));
+    conn->connect(srv->sockaddr().value());
+
+    int64_t new_elapsed = -1, old_elapsed = -1;
+    conn->eof_event.add([&](auto...) {
+        new_elapsed = time_elapsed();
+        if (old_elapsed >= 0) test.loop->stop();
+    });
+    p.conn->eof_event.add([&](auto...) {
+        old_elapsed = time_elapsed();
+        if (new_elapsed >= 0) test.loop->stop();
+    });
+    test.run();
+
+    CHECK(new_elapsed >= 19);
+    CHECK(new_elapsed < 200);
+    CHECK(old_elapsed >= 399); // connection armed before the change keeps its deadline
+    CHECK(old_elapsed < 500);
+}
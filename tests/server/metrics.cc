@@ -0,0 +1,116 @@
+#include "../lib/test.h"
+#include <panda/unievent/http/MultiServer.h>
+
+#define TEST(name) TEST_CASE("server-metrics: " name, "[server-metrics]" VSSL)
+
+TEST("counters") {
+    AsyncTest test(1000);
+    ServerPair p(test.loop);
+    p.server->request_event.add([](auto& req) {
+        req->respond(new ServerResponse(req->uri->path() == "/missing" ? 404 : 200, Headers(), Body("hi")));
+    });
+
+    CHECK(p.get_response("GET / HTTP/1.1\r\n\r\n")->code == 200);
+    CHECK(p.get_response("GET /missing HTTP/1.1\r\n\r\n")->code == 404);
+    p.conn->write("GET / HTTP/1.1\r\n\r\nGET / HTTP/1.1\r\n\r\n");
+    p.get_response();
+    p.get_response();
+    test.loop->run_nowait(); // write callbacks, latency is measured when the response is written
+
+    auto m = p.server->metrics().snapshot();
+    CHECK(m.accepted == 1);
+    CHECK(m.active == 1);
+    CHECK(m.requests == 4);
+    CHECK(m.keepalive_reuse == 3);
+    CHECK(m.pipelined == 1);
+    CHECK(m.pipeline_depth == 2);
+    CHECK(m.responses_4xx == 1);
+    CHECK(m.responses_5xx == 0);
+    CHECK(m.parse_errors == 0);
+    CHECK(m.bytes_in > 0);
+    CHECK(m.bytes_out > 0);
+    CHECK(m.latency_count() == 4);
+    CHECK(m.latency_percentile(100) >= m.latency_percentile(50));
+
+    SECTION("parse error") {
+        CHECK(p.get_response("GET / HTTP/1.1\r\nbad header\r\n\r\n")->code == 400);
+        m = p.server->metrics().snapshot();
+        CHECK(m.parse_errors == 1);
+        CHECK(m.responses_4xx == 2);
+    }
+
+    SECTION("stop") {
+        p.server->stop();
+        CHECK(p.server->metrics().active.load() == 0);
+    }
+}
+
+TEST("histogram precision") {
+    using H = ServerMetrics::Histogram;
+    for (uint64_t v : {0ull, 1ull, 63ull, 64ull, 65ull, 1000ull, 123456ull, 10000000ull, 1ull << 40}) {
+        auto upper = H::value(H::index(v));
+        CHECK(upper >= v);
+        CHECK(upper - v <= v / 32);
+    }
+}
+
+TEST("prometheus export") {
+    AsyncTest test(1000);
+    Server::Config cfg;
+    cfg.metrics_path = "/metrics";
+    ServerPair p(test.loop, cfg);
+    int calls = 0;
+    p.server->request_event.add([&](auto& req) {
+        ++calls;
+        req->respond(new ServerResponse(200, Headers(), Body("hi")));
+    });
+
+    p.get_response("GET / HTTP/1.1\r\n\r\n");
+    auto res = p.get_response("GET /metrics HTTP/1.1\r\n\r\n");
+    CHECK(calls == 1);
+    CHECK(res->code == 200);
+    CHECK(res->headers.get("Content-Type") == "text/plain; version=0.0.4");
+    auto body = res->body.to_string();
+    CHECK(body.find("# TYPE unievent_http_server_requests_total counter\n") != string::npos);
+    CHECK(body.find("\nunievent_http_server_requests_total 1\n") != string::npos);
+    CHECK(body.find("\nunievent_http_server_connections_active 1\n") != string::npos);
+    CHECK(body.find("unievent_http_server_request_duration_seconds_bucket{le=\"+Inf\"} ") != string::npos);
+    CHECK(body.find("\nunievent_http_server_request_duration_seconds_count ") != string::npos);
+}
+
+TEST("multi server sums up workers") {
+    AsyncTest test(5000, {"stop"});
+    MultiServer::Config cfg;
+    cfg.workers = 2;
+    cfg.metrics_path = "/metrics";
+    cfg.locations.push_back(Server::Location("127.0.0.1", 0));
+    MultiServerSP server = new MultiServer(cfg, test.loop);
+    server->request_event.add([](const ServerRequestSP& req) {
+        req->respond(new ServerResponse(200, Headers(), Body("hi")));
+    });
+    server->run();
+
+    auto sa = server->sockaddr().value();
+    string uri = string("http://") + sa.ip() + ":" + to_string(sa.port()) + "/";
+    std::vector<RequestSP> reqs;
+    for (int i = 0; i < 10; ++i) {
+        auto req = Request::Builder().uri(uri).build();
+        http_request(req, test.loop);
+        reqs.push_back(req);
+    }
+    REQUIRE(await_responses(reqs, test.loop).size() == 10);
+    CHECK(server->metrics().requests == 10);
+
+    auto req = Request::Builder().uri(uri + "metrics").build();
+    http_request(req, test.loop);
+    auto res = await_responses({req}, test.loop);
+    REQUIRE(res.size() == 1);
+    CHECK(res[0]->body.to_string().find("\nunievent_http_server_requests_total 10\n") != string::npos);
+
+    server->stop_event.add([&]{
+        test.happens("stop");
+        test.loop->stop();
+    });
+    server->stop();
+    test.run();
+}
@@ -0,0 +1,87 @@
+#include "../lib/test.h"
+#include <panda/unievent/http/MultiServer.h>
+#include <atomic>
+
+#define TEST(name) TEST_CASE("server-multi: " name, "[server-multi]")
+
+static MultiServerSP make_multi (const LoopSP& loop, uint32_t workers) {
+    MultiServer::Config cfg;
+    cfg.workers = workers;
+    cfg.locations.push_back(Server::Location("127.0.0.1", 0));
+    MultiServerSP server = new MultiServer(cfg, loop);
+    server->request_event.add([](const ServerRequestSP& req) {
+        req->respond(new ServerResponse(200, Headers(), Body("hi")));
+    });
+    return server;
+}
+
+TEST("requests are served by workers") {
+    AsyncTest test(5000, {"stop"});
+    auto server = make_multi(test.loop, 4);
+
+    std::atomic<int> inits(0);
+    server->init_event.add([&](const ServerSP&) { ++inits; });
+    server->run();
+    CHECK(inits == 4);
+    CHECK(server->running());
+    CHECK_THROWS(server->run());
+
+    auto sa = server->sockaddr().value();
+    CHECK(sa.port());
+    string uri = string("http://") + sa.ip() + ":" + to_string(sa.port()) + "/";
+
+    std::vector<RequestSP> reqs;
+    for (int i = 0; i < 20; ++i) {
+        auto req = Request::Builder().uri(uri).build();
+        http_request(req, test.loop);
+        reqs.push_back(req);
+    }
+    auto responses = await_responses(reqs, test.loop);
+    REQUIRE(responses.size() == 20);
+    for (auto& res : responses) {
+        CHECK(res->code == 200);
+        CHECK(res->body.to_string() == "hi");
+    }
+
+    server->stop_event.add([&]{
+        test.happens("stop");
+        test.loop->stop();
+    });
+    server->graceful_stop();
+    CHECK(server->stopping());
+    test.run();
+    CHECK_FALSE(server->running());
+    CHECK_FALSE(server->sockaddr());
+}
+
+TEST("hard stop") {
+    AsyncTest test(5000, {"stop"});
+    auto server = make_multi(test.loop, 2);
+    server->run();
+    server->stop_event.add([&]{
+        test.happens("stop");
+        test.loop->stop();
+    });
+    server->stop();
+    test.run();
+    CHECK_FALSE(server->running());
+}
+
+TEST("worker initialization error is rethrown from run") {
+    AsyncTest test(5000);
+    MultiServer::Config cfg;
+    cfg.workers = 2;
+    cfg.locations.push_back(Server::Location("", 0)); // neither host nor path
+    MultiServerSP server = new MultiServer(cfg, test.loop);
+    CHECK_THROWS_AS(server->run(), HttpError);
+    CHECK_FALSE(server->running());
+}
+
+TEST("unshareable locations") {
+    MultiServer::Config cfg;
+    cfg.workers = 2;
+    Server::Location loc;
+    loc.path = "tests/testsock";
+    cfg.locations.push_back(loc);
+    CHECK_THROWS_AS(MultiServerSP(new MultiServer(cfg)), HttpError);
+}
@@ -0,0 +1,238 @@
+#include "../lib/test.h"
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+#define TEST(name) TEST_CASE("server-trace: " name, "[server-trace]" VSSL)
+
+static const char* TRACEPARENT = "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01";
+
+namespace {
+    // tracing is global, so it's turned off after every test
+    struct TraceGuard {
+        MemoryTraceSink sink;
+        TraceGuard (double sample_rate = 1) { Tracer::configure(&sink, sample_rate); }
+        ~TraceGuard () { Tracer::configure(nullptr); }
+    };
+}
+
+static std::vector<string> event_names (const TraceSpan& span) {
+    std::vector<string> ret;
+    for (auto& e : span.events) ret.push_back(e.name);
+    return ret;
+}
+
+TEST("traceparent") {
+    auto ctx = TraceContext::parse(TRACEPARENT);
+    CHECK(ctx.valid());
+    CHECK(ctx.sampled);
+    CHECK(ctx.traceparent() == TRACEPARENT);
+    CHECK(ctx.span_id[0] == 0x00);
+    CHECK(ctx.span_id[7] == 0xb7);
+
+    CHECK_FALSE(TraceContext::parse("00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-00").sampled);
+    CHECK(TraceContext::parse("01-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01-future").valid());
+
+    CHECK_FALSE(TraceContext::parse("").valid());
+    CHECK_FALSE(TraceContext::parse("ff-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01").valid());
+    CHECK_FALSE(TraceContext::parse("00-00000000000000000000000000000000-00f067aa0ba902b7-01").valid());
+    CHECK_FALSE(TraceContext::parse("00-4bf92f3577b34da6a3ce929d0e0e4736-0000000000000000-01").valid());
+    CHECK_FALSE(TraceContext::parse("00-4BF92F3577B34DA6A3CE929D0E0E4736-00f067aa0ba902b7-01").valid());
+    CHECK_FALSE(TraceContext::parse("00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01x").valid());
+}
+
+TEST("server span") {
+    AsyncTest test(1000);
+    TraceGuard trace;
+    ServerPair p(test.loop);
+    p.server->request_event.add([](auto& req) {
+        req->respond(new ServerResponse(200, Headers(), Body("hi")));
+    });
+
+    SECTION("root") {
+        CHECK(p.get_response("GET /path HTTP/1.1\r\n\r\n")->code == 200);
+        auto spans = trace.sink.take();
+        REQUIRE(spans.size() == 1);
+        auto& span = spans[0];
+        CHECK(span.kind == TraceSpan::Kind::server);
+        CHECK(span.name == "GET");
+        CHECK(span.context.valid());
+        CHECK(span.context.sampled);
+        CHECK_FALSE(span.parent.valid());
+        CHECK(span.status_code == 200);
+        CHECK_FALSE(span.error);
+        CHECK(event_names(span) == std::vector<string>{"parse_start", "parse_headers", "route", "parse_end", "respond", "first_write"});
+        CHECK(span.start <= span.events.front().time);
+        CHECK(span.events.back().time <= span.end);
+        auto path = std::find_if(span.attributes.begin(), span.attributes.end(), [](auto& a) { return string(a.first) == "url.path"; });
+        REQUIRE(path != span.attributes.end());
+        CHECK(path->second == "/path");
+    }
+
+    SECTION("child of remote parent") {
+        p.get_response(string("GET / HTTP/1.1\r\ntraceparent: ") + TRACEPARENT + "\r\n\r\n");
+        auto spans = trace.sink.take();
+        REQUIRE(spans.size() == 1);
+        auto parent = TraceContext::parse(TRACEPARENT);
+        CHECK(spans[0].parent.span_id == parent.span_id);
+        CHECK(spans[0].context.trace_id == parent.trace_id);
+        CHECK(spans[0].context.span_id != parent.span_id);
+    }
+}
+
+TEST("sampling") {
+    AsyncTest test(1000);
+    TraceGuard trace(0);
+    ServerPair p(test.loop);
+    p.server->request_event.add([](auto& req) {
+        req->respond(new ServerResponse(200));
+    });
+
+    p.get_response("GET / HTTP/1.1\r\n\r\n");
+    CHECK(trace.sink.take().size() == 0);
+
+    p.get_response(string("GET / HTTP/1.1\r\ntraceparent: ") + TRACEPARENT + "\r\n\r\n"); // parent's decision wins
+    CHECK(trace.sink.take().size() == 1);
+}
+
+TEST("dropped request") {
+    AsyncTest test(1000, {"stop"});
+    TraceGuard trace;
+    ServerPair p(test.loop);
+    p.server->request_event.add([&](auto) {
+        p.server->stop();
+    });
+    p.server->stop_event.add([&]{
+        test.happens("stop");
+    });
+    p.conn->write("GET / HTTP/1.1\r\n\r\n");
+    test.run();
+
+    auto spans = trace.sink.take();
+    REQUIRE(spans.size() == 1);
+    CHECK(spans[0].error);
+    CHECK(spans[0].status_code == 0);
+    CHECK(event_names(spans[0]).back() == "drop");
+}
+
+TEST("propagation through client") {
+    AsyncTest test(3000);
+    TraceGuard trace;
+    ServerPair front(test.loop);
+    auto backend = make_server(test.loop);
+    TPool pool(Pool::Config(), test.loop);
+
+    string received_traceparent;
+    backend->request_event.add([&](auto& req) {
+        received_traceparent = req->headers.get("traceparent");
+        req->respond(new ServerResponse(200, Headers(), Body("backend")));
+    });
+    front.server->request_event.add([&](const ServerRequestSP& req) {
+        auto breq = Request::Builder().uri(active_scheme() + "://" + backend->location() + "/").build();
+        breq->response_event.add([req](auto&, auto& res, auto&) {
+            req->respond(new ServerResponse(res->code, Headers(), Body(res->body.to_string())));
+        });
+        pool.request(breq);
+    });
+
+    auto res = front.get_response("GET / HTTP/1.1\r\n\r\n");
+    CHECK(res->body.to_string() == "backend");
+
+    auto spans = trace.sink.take();
+    REQUIRE(spans.size() == 3); // front server, client, backend server
+    auto find = [&](TraceSpan::Kind kind, const TraceContext& parent) -> const TraceSpan* {
+        for (auto& s : spans) if (s.kind == kind && s.parent.span_id == parent.span_id) return &s;
+        return nullptr;
+    };
+    auto front_span = find(TraceSpan::Kind::server, TraceContext());
+    REQUIRE(front_span);
+    auto client_span = find(TraceSpan::Kind::client, front_span->context);
+    REQUIRE(client_span);
+    auto backend_span = find(TraceSpan::Kind::server, client_span->context);
+    REQUIRE(backend_span);
+
+    CHECK(received_traceparent == client_span->context.traceparent());
+    CHECK(client_span->context.trace_id == front_span->context.trace_id);
+    CHECK(backend_span->context.trace_id == front_span->context.trace_id);
+    CHECK(client_span->status_code == 200);
+    auto events = event_names(*client_span);
+    CHECK(std::find(events.begin(), events.end(), "written") != events.end());
+    CHECK(std::find(events.begin(), events.end(), "first_byte") != events.end());
+}
+
+TEST("client request restores user's traceparent") {
+    AsyncTest test(1000);
+    TraceGuard trace;
+    auto srv = make_server(test.loop);
+    string received;
+    srv->request_event.add([&](auto& req) {
+        received = req->headers.get("traceparent");
+        req->respond(new ServerResponse(200));
+    });
+    TPool pool(Pool::Config(), test.loop);
+
+    auto req = Request::Builder().uri(active_scheme() + "://" + srv->location() + "/").header("traceparent", TRACEPARENT).build();
+    pool.request(req);
+    await_response(req, test.loop);
+
+    auto ctx = TraceContext::parse(received);
+    CHECK(ctx.valid());
+    CHECK(ctx.trace_id == TraceContext::parse(TRACEPARENT).trace_id);
+    CHECK(received != TRACEPARENT);
+    CHECK(req->headers.get("traceparent") == TRACEPARENT);
+}
+
+TEST("file sink") {
+    string path = "trace-test.json";
+    ::remove(path.c_str());
+    {
+        FileTraceSink sink(path, "svc");
+        TraceSpan span;
+        span.kind    = TraceSpan::Kind::client;
+        span.context = TraceContext::parse(TRACEPARENT);
+        span.name    = "GET";
+        span.start   = 1;
+        span.end     = 2;
+        span.attributes.emplace_back("url.full", "http://x/\"q\"");
+        span.status_code = 503;
+        span.event("first_byte", 1);
+        sink.export_span(span);
+    }
+    FILE* f = fopen(path.c_str(), "r");
+    REQUIRE(f);
+    char buf[4096];
+    auto len = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    ::remove(path.c_str());
+    string line(buf, len);
+
+    CHECK(line.find("{\"resourceSpans\":[{\"resource\":{\"attributes\":[{\"key\":\"service.name\",\"value\":{\"stringValue\":\"svc\"}}]}") == 0);
+    CHECK(line.find("\"traceId\":\"4bf92f3577b34da6a3ce929d0e0e4736\",\"spanId\":\"00f067aa0ba902b7\",\"name\":\"GET\",\"kind\":3") != string::npos);
+    CHECK(line.find("\"startTimeUnixNano\":\"1\",\"endTimeUnixNano\":\"2\"") != string::npos);
+    CHECK(line.find("\"stringValue\":\"http://x/\\\"q\\\"\"") != string::npos);
+    CHECK(line.find("{\"timeUnixNano\":\"1\",\"name\":\"first_byte\"}") != string::npos);
+    CHECK(line.find("\"status\":{\"code\":2}") != string::npos);
+    CHECK(line[line.length() - 1] == '\n');
+}
+
+TEST("file sink writes in background") {
+    string path = "trace-test-bg.json";
+    ::remove(path.c_str());
+    FileTraceSink sink(path, "svc", 10);
+    TraceSpan span;
+    span.context = TraceContext::parse(TRACEPARENT);
+    span.name    = "GET";
+    sink.export_span(span);
+
+    auto size = [&]{
+        FILE* f = fopen(path.c_str(), "r");
+        if (!f) return 0l;
+        fseek(f, 0, SEEK_END);
+        auto ret = ftell(f);
+        fclose(f);
+        return ret;
+    };
+    for (int i = 0; i < 100 && !size(); ++i) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    CHECK(size() > 0); // while the sink is still alive
+    ::remove(path.c_str());
+}
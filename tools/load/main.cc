@@ -0,0 +1,302 @@
+// unievent-http-load: wrk-like HTTP load generator built on Pool, so it exercises (and measures) this library's client side
+#include <panda/unievent/http.h>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using namespace panda;
+using panda::unievent::Loop;
+using panda::unievent::LoopSP;
+using panda::unievent::Timer;
+using panda::unievent::TimerSP;
+using namespace panda::unievent::http;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// percentile distribution in HdrHistogram's .hgrm format (values in milliseconds), can be fed to its plotter
+void print_hgrm (std::ostream& os, const LatencyHistogram& h) {
+    char buf[128];
+    os << "       Value     Percentile TotalCount 1/(1-Percentile)\n\n";
+    auto& counts = h.buckets();
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        if (!counts[i]) continue;
+        seen += counts[i];
+        double p = double(seen) / h.count();
+        auto value = std::min(LatencyHistogram::value(i), h.max()) / 1000.0;
+        if (seen == h.count()) snprintf(buf, sizeof(buf), "%12.3f %14.12f %10llu\n", value, p, (unsigned long long)seen);
+        else snprintf(buf, sizeof(buf), "%12.3f %14.12f %10llu %14.2f\n", value, p, (unsigned long long)seen, 1 / (1 - p));
+        os << buf;
+    }
+    snprintf(buf, sizeof(buf), "#[Mean    = %12.3f]\n#[Max     = %12.3f, Total count    = %12llu]\n", h.mean() / 1000, h.max() / 1000.0,
+             (unsigned long long)h.count());
+    os << buf;
+}
+
+struct Stats {
+    LatencyHistogram latency; // [us]
+    uint64_t         responses = 0; // including non-2xx/3xx ones
+    uint64_t         non2xx    = 0;
+    uint64_t         errors    = 0; // connect/read/write errors and timeouts, no response
+    uint64_t         timeouts  = 0;
+    uint64_t         bytes     = 0; // of response bodies
+
+    void merge (const Stats& s) {
+        latency   += s.latency;
+        responses += s.responses;
+        non2xx    += s.non2xx;
+        errors    += s.errors;
+        timeouts  += s.timeouts;
+        bytes     += s.bytes;
+    }
+};
+
+struct Config {
+    std::vector<std::string> uris;   // round-robin; "{n}" is replaced with request's sequence number
+    Request::Method method = Request::Method::Get;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+    uint32_t    connections = 10;    // per thread
+    uint32_t    concurrency = 0;     // requests in flight per thread, 0 = connections * max(depth, 1)
+    uint32_t    depth       = 0;     // pipelining depth per connection, see Pool::Config::pipeline_depth
+    uint32_t    threads     = 1;
+    double      duration    = 10;    // [s], ignored if `requests` is set
+    uint64_t    requests    = 0;     // total to send
+    uint64_t    timeout     = 10000; // [ms] per request
+    bool        insecure    = false; // don't verify server's certificate
+    bool        json        = false;
+    std::string hgrm;                // file to write latency distribution to
+};
+
+// one loop with its own Pool per thread, loops share nothing
+struct Worker {
+    Worker (const Config& cfg, uint64_t requests) : _cfg(cfg), _limit(requests) {}
+
+    void run () {
+        _loop = new Loop();
+        Pool::Config pcfg;
+        pcfg.max_connections = _cfg.connections;
+        pcfg.pipeline_depth  = _cfg.depth;
+        _pool = new Pool(pcfg, _loop);
+
+        TimerSP deadline;
+        if (!_limit) {
+            deadline = new Timer(_loop);
+            deadline->event.add([this](auto&) {
+                _stopping = true;
+                if (!_inflight) _loop->stop();
+            });
+            deadline->once(uint64_t(_cfg.duration * 1000));
+        }
+
+        auto concurrency = _cfg.concurrency ? _cfg.concurrency : _cfg.connections * std::max<uint32_t>(_cfg.depth, 1);
+        auto start = Clock::now();
+        for (uint32_t i = 0; i < concurrency && can_send(); ++i) send();
+        if (_inflight) _loop->run();
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        if (deadline) deadline->stop();
+        _pool  = nullptr;
+        _loop  = nullptr;
+    }
+
+    Stats  stats;
+    double seconds = 0;
+
+private:
+    const Config& _cfg;
+    uint64_t      _limit;
+    uint64_t      _sent     = 0;
+    uint64_t      _inflight = 0;
+    bool          _stopping = false;
+    LoopSP        _loop;
+    PoolSP        _pool;
+
+    bool can_send () const { return !_stopping && (!_limit || _sent < _limit); }
+
+    void send () {
+        auto seq = _sent++;
+        std::string uri = _cfg.uris[seq % _cfg.uris.size()];
+        auto pos = uri.find("{n}");
+        if (pos != std::string::npos) uri.replace(pos, 3, std::to_string(seq));
+
+        Headers headers;
+        for (auto& h : _cfg.headers) headers.add(string(h.first.data(), h.first.size()), string(h.second.data(), h.second.size()));
+
+        auto b = Request::Builder()
+            .method(_cfg.method)
+            .uri(string(uri.data(), uri.size()))
+            .headers(std::move(headers))
+            .timeout(_cfg.timeout)
+            .follow_redirect(false);
+        if (_cfg.body.size()) b.body(string(_cfg.body.data(), _cfg.body.size()));
+        if (_cfg.insecure) b.ssl_check_cert(false);
+        auto req = b.build();
+
+        auto start = Clock::now();
+        req->response_event.add([this, start](auto&, auto& res, auto& err) {
+            --_inflight;
+            if (err) {
+                ++stats.errors;
+                if (err.contains(make_error_code(std::errc::timed_out))) ++stats.timeouts;
+            } else {
+                stats.latency.add(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+                ++stats.responses;
+                if (res->code < 200 || res->code >= 400) ++stats.non2xx;
+                stats.bytes += res->body.length();
+            }
+            if (can_send()) send();
+            else if (!_inflight) _loop->stop();
+        });
+        ++_inflight;
+        _pool->request(req);
+    }
+};
+
+void usage () {
+    std::cerr <<
+        "usage: unievent-http-load [options] <url> [<url> ...]\n"
+        "  -c, --connections N   connections per thread (default 10)\n"
+        "  -n, --concurrency N   requests in flight per thread (default connections * max(depth, 1))\n"
+        "  -p, --pipeline N      pipelining depth per connection (default 0 = off)\n"
+        "  -t, --threads N       threads, each with its own loop and pool (default 1)\n"
+        "  -d, --duration S      seconds to run (default 10)\n"
+        "  -r, --requests N      total number of requests to send instead of running for duration\n"
+        "  -m, --method M        GET, HEAD, POST, PUT, DELETE, OPTIONS, TRACE (default GET)\n"
+        "  -H, --header 'K: V'   add request header, may be repeated\n"
+        "  -b, --body STRING     request body\n"
+        "      --body-file PATH  request body from file\n"
+        "      --timeout MS      per request timeout (default 10000)\n"
+        "  -k, --insecure        don't verify server certificate for https urls\n"
+        "      --json            print summary as a JSON object\n"
+        "      --hgrm PATH       write latency percentile distribution in HdrHistogram format\n"
+        "  \"{n}\" in url is replaced with request's sequence number; multiple urls are requested round-robin\n";
+}
+
+Request::Method parse_method (const char* s) {
+    static const std::pair<const char*, Request::Method> methods[] = {
+        {"GET", Request::Method::Get}, {"HEAD", Request::Method::Head}, {"POST", Request::Method::Post}, {"PUT", Request::Method::Put},
+        {"DELETE", Request::Method::Delete}, {"OPTIONS", Request::Method::Options}, {"TRACE", Request::Method::Trace},
+    };
+    for (auto& m : methods) if (!strcasecmp(s, m.first)) return m.second;
+    throw std::invalid_argument(std::string("unsupported method ") + s);
+}
+
+Config parse_args (int argc, char** argv) {
+    Config cfg;
+    auto value = [&](int& i) -> const char* {
+        if (i + 1 >= argc) throw std::invalid_argument(std::string("missing value for ") + argv[i]);
+        return argv[++i];
+    };
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if      (arg == "-c" || arg == "--connections") cfg.connections = atoi(value(i));
+        else if (arg == "-n" || arg == "--concurrency") cfg.concurrency = atoi(value(i));
+        else if (arg == "-p" || arg == "--pipeline")    cfg.depth       = atoi(value(i));
+        else if (arg == "-t" || arg == "--threads")     cfg.threads     = atoi(value(i));
+        else if (arg == "-d" || arg == "--duration")    cfg.duration    = atof(value(i));
+        else if (arg == "-r" || arg == "--requests")    cfg.requests    = strtoull(value(i), nullptr, 10);
+        else if (arg == "-m" || arg == "--method")      cfg.method      = parse_method(value(i));
+        else if (arg == "-b" || arg == "--body")        cfg.body        = value(i);
+        else if (arg == "--timeout")                    cfg.timeout     = strtoull(value(i), nullptr, 10);
+        else if (arg == "-k" || arg == "--insecure")    cfg.insecure    = true;
+        else if (arg == "--json")                       cfg.json        = true;
+        else if (arg == "--hgrm")                       cfg.hgrm        = value(i);
+        else if (arg == "-H" || arg == "--header") {
+            std::string h = value(i);
+            auto pos = h.find(':');
+            if (pos == std::string::npos) throw std::invalid_argument("bad header '" + h + "', expected 'Name: value'");
+            auto vpos = h.find_first_not_of(' ', pos + 1);
+            cfg.headers.emplace_back(h.substr(0, pos), vpos == std::string::npos ? std::string() : h.substr(vpos));
+        }
+        else if (arg == "--body-file") {
+            std::ifstream f(value(i), std::ios::binary);
+            if (!f) throw std::invalid_argument(std::string("can not read ") + argv[i]);
+            cfg.body.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        }
+        else if (arg.size() && arg[0] == '-') throw std::invalid_argument("unknown option " + arg);
+        else cfg.uris.push_back(arg);
+    }
+    if (cfg.uris.empty()) throw std::invalid_argument("no url given");
+    if (!cfg.connections || !cfg.threads) throw std::invalid_argument("connections and threads must be positive");
+    return cfg;
+}
+
+void print_text (const Config& cfg, const Stats& s, double seconds) {
+    char buf[256];
+    printf("%u threads, %u connections per thread", cfg.threads, cfg.connections);
+    if (cfg.depth) printf(", pipeline depth %u", cfg.depth);
+    printf("\n  %llu responses in %.2fs, %.2f MB read\n", (unsigned long long)s.responses, seconds, s.bytes / 1048576.0);
+    printf("  Requests/sec: %12.2f\n", seconds > 0 ? s.responses / seconds : 0);
+    if (s.errors) printf("  Errors: %llu (timeouts %llu)\n", (unsigned long long)s.errors, (unsigned long long)s.timeouts);
+    if (s.non2xx) printf("  Non-2xx or 3xx responses: %llu\n", (unsigned long long)s.non2xx);
+    printf("  Latency distribution [ms]:\n");
+    static const double pcts[] = {50, 75, 90, 99, 99.9, 99.99};
+    for (auto p : pcts) {
+        snprintf(buf, sizeof(buf), "    %7.3f%%  %10.3f\n", p, s.latency.percentile(p) / 1000.0);
+        fputs(buf, stdout);
+    }
+    printf("    %8s  %10.3f\n    %8s  %10.3f\n", "mean", s.latency.mean() / 1000, "max", s.latency.max() / 1000.0);
+}
+
+void print_json (const Config& cfg, const Stats& s, double seconds) {
+    printf("{\"threads\":%u,\"connections\":%u,\"depth\":%u,\"seconds\":%.6f,\"responses\":%llu,\"rate\":%.1f,\"errors\":%llu,\"timeouts\":%llu,"
+           "\"non2xx\":%llu,\"bytes\":%llu,\"latency_us\":{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu,\"mean\":%.1f}}\n",
+           cfg.threads, cfg.connections, cfg.depth, seconds, (unsigned long long)s.responses, seconds > 0 ? s.responses / seconds : 0,
+           (unsigned long long)s.errors, (unsigned long long)s.timeouts, (unsigned long long)s.non2xx, (unsigned long long)s.bytes,
+           (unsigned long long)s.latency.percentile(50), (unsigned long long)s.latency.percentile(90),
+           (unsigned long long)s.latency.percentile(99), (unsigned long long)s.latency.percentile(99.9),
+           (unsigned long long)s.latency.max(), s.latency.mean());
+}
+
+}
+
+int main (int argc, char** argv) {
+    Config cfg;
+    try {
+        cfg = parse_args(argc, argv);
+    } catch (std::exception& e) {
+        std::cerr << e.what() << "\n";
+        usage();
+        return 2;
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (uint32_t i = 0; i < cfg.threads; ++i) {
+        uint64_t share = cfg.requests / cfg.threads + (i < cfg.requests % cfg.threads);
+        if (cfg.requests && !share) break;
+        workers.emplace_back(new Worker(cfg, share));
+    }
+
+    std::vector<std::thread> threads;
+    for (auto& w : workers) threads.emplace_back([&w]{ w->run(); });
+    for (auto& t : threads) t.join();
+
+    Stats  total;
+    double seconds = 0;
+    for (auto& w : workers) {
+        total.merge(w->stats);
+        seconds = std::max(seconds, w->seconds);
+    }
+
+    if (cfg.json) print_json(cfg, total, seconds);
+    else          print_text(cfg, total, seconds);
+
+    if (cfg.hgrm.size()) {
+        std::ofstream f(cfg.hgrm);
+        print_hgrm(f, total.latency);
+    }
+    return total.responses ? 0 : 1;
+}